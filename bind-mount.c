@@ -32,8 +32,10 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include <obstack.h>
 #include "bind-mount.h"
+#include "probes.h"
 
 #define MOUNTINFO_PATH "/proc/self/mountinfo"
 
@@ -57,16 +59,6 @@ obstack_chunk_alloc(long size)
 #define OBSTACK_OBJECT_SIZE(H) \
   (size_t)((char *)obstack_next_free (H) - (char *)obstack_base (H))
 
-/* A list of strings */
-struct string_list
-{
-    char **entries;
-    size_t len;			/* Number of valid entries */
-    /* Number of allocated entries, usually invalid after the list is "finished"
-       and ENTRIES are reallocated to the exact size. */
-    size_t allocated;
-};
-
 /* Append STRING to LIST */
 static void
 string_list_append(struct string_list *list, char *string)
@@ -90,42 +82,26 @@ struct mount
     char *source;
 };
 
-/* Pointers to struct mount. */
-static void **mount_entries;
-static size_t num_mount_entries;
-
-/* Obstack of struct mount entries. */
-static struct obstack mount_data_obstack;
-static void *mount_data_mark;
-/* Obstack of strings referenced in mount entries. */
-static struct obstack mount_string_obstack;
-static void *mount_string_mark;
-/* Obstack of 'void *' (struct mount *) pointers, for mount_entries */
-static struct obstack mount_list_obstack;
-
-/* Obstack used for a MOUNTINFO_PATH line buffer */
-static struct obstack mountinfo_line_obstack;
-
-/* Initialize state for read_mount_entries() */
+/* Initialize state of BM for read_mount_entries() */
 static void
-init_mount_entries(void)
+init_mount_entries(struct bind_mounts *bm)
 {
-    obstack_init(&mount_data_obstack);
-    mount_data_mark = obstack_alloc(&mount_data_obstack, 0);
-    obstack_init(&mount_string_obstack);
-    obstack_alignment_mask(&mount_string_obstack) = 0;
-    mount_string_mark = obstack_alloc(&mount_string_obstack, 0);
-    obstack_init(&mount_list_obstack);
-    mount_entries = obstack_alloc(&mount_list_obstack, 0);
-    obstack_init(&mountinfo_line_obstack);
-    obstack_alignment_mask(&mountinfo_line_obstack) = 0;
+    obstack_init(&bm->mount_data_obstack);
+    bm->mount_data_mark = obstack_alloc(&bm->mount_data_obstack, 0);
+    obstack_init(&bm->mount_string_obstack);
+    obstack_alignment_mask(&bm->mount_string_obstack) = 0;
+    bm->mount_string_mark = obstack_alloc(&bm->mount_string_obstack, 0);
+    obstack_init(&bm->mount_list_obstack);
+    bm->mount_entries = obstack_alloc(&bm->mount_list_obstack, 0);
+    obstack_init(&bm->mountinfo_line_obstack);
+    obstack_alignment_mask(&bm->mountinfo_line_obstack) = 0;
 }
 
 /* Read a line from F.
-   Return a string pointer (to be freed in mountinfo_line_obstack), or NULL on
-   error. */
+   Return a string pointer (to be freed in bm->mountinfo_line_obstack), or
+   NULL on error. */
 static char *
-read_mount_line(FILE *f)
+read_mount_line(struct bind_mounts *bm, FILE *f)
 {
     char *line;
 
@@ -140,25 +116,25 @@ read_mount_line(FILE *f)
 	}
 	chunk_length = strlen(buf);
 	if (chunk_length > 0 && buf[chunk_length - 1] == '\n') {
-	    obstack_grow(&mountinfo_line_obstack, buf, chunk_length - 1);
+	    obstack_grow(&bm->mountinfo_line_obstack, buf, chunk_length - 1);
 	    break;
 	}
-	obstack_grow(&mountinfo_line_obstack, buf, chunk_length);
+	obstack_grow(&bm->mountinfo_line_obstack, buf, chunk_length);
     }
-    obstack_1grow(&mountinfo_line_obstack, 0);
-    return obstack_finish(&mountinfo_line_obstack);
+    obstack_1grow(&bm->mountinfo_line_obstack, 0);
+    return obstack_finish(&bm->mountinfo_line_obstack);
 
 error:
-    line = obstack_finish(&mountinfo_line_obstack);
-    obstack_free(&mountinfo_line_obstack, line);
+    line = obstack_finish(&bm->mountinfo_line_obstack);
+    obstack_free(&bm->mountinfo_line_obstack, line);
     return NULL;
 }
 
 /* Parse a space-delimited entry in STRING, decode octal escapes, write it to
-   DEST (allocated from mount_string_obstack) if it is not NULL.
+   DEST (allocated from bm->mount_string_obstack) if it is not NULL.
    Return 0 if OK, -1 on error. */
 static int
-parse_mount_string(char **dest, char **string)
+parse_mount_string(struct bind_mounts *bm, char **dest, char **string)
 {
     char *src, *ret;
 
@@ -184,7 +160,7 @@ parse_mount_string(char **dest, char **string)
 		v = ((src[1] - '0') << 6) | ((src[2] - '0') << 3)
 		    | (src[3] - '0');
 		if (v <= UCHAR_MAX) {
-		  obstack_1grow(&mount_string_obstack, (char)v);
+		  obstack_1grow(&bm->mount_string_obstack, (char)v);
 		  src += 4;
 		  break;
 		}
@@ -192,75 +168,75 @@ parse_mount_string(char **dest, char **string)
 	    /* Else fall through */
 
 	default:
-	  obstack_1grow(&mount_string_obstack, c);
+	  obstack_1grow(&bm->mount_string_obstack, c);
 	  src++;
 	}
     }
  done:
     *string = src;
-    obstack_1grow(&mount_string_obstack, 0);
-    ret = obstack_finish(&mount_string_obstack);
+    obstack_1grow(&bm->mount_string_obstack, 0);
+    ret = obstack_finish(&bm->mount_string_obstack);
     if (dest != NULL)
 	*dest = ret;
     else
-	obstack_free(&mount_string_obstack, ret);
+	obstack_free(&bm->mount_string_obstack, ret);
     return 0;
 
 error:
-    ret = obstack_finish(&mount_string_obstack);
-    obstack_free(&mount_string_obstack, ret);
+    ret = obstack_finish(&bm->mount_string_obstack);
+    obstack_free(&bm->mount_string_obstack, ret);
     return -1;
 }
 
 /* Read a single entry from F.
    Return the entry, or NULL on error. */
 static struct mount *
-read_mount_entry(FILE *f)
+read_mount_entry(struct bind_mounts *bm, FILE *f)
 {
     struct mount *me;
     char *line;
     size_t offset;
     bool separator_found;
 
-    line = read_mount_line(f);
+    line = read_mount_line(bm, f);
     if (line == NULL)
 	return NULL;
-    me = obstack_alloc(&mount_data_obstack, sizeof (*me));
+    me = obstack_alloc(&bm->mount_data_obstack, sizeof (*me));
     if (sscanf(line, "%d %d %u:%u%zn", &me->id, &me->parent_id, &me->dev_major,
 	       &me->dev_minor, &offset) != 4)
 	goto error;
     line += offset;
-    if (parse_mount_string(&me->root, &line) != 0
-	|| parse_mount_string(&me->mount_point, &line) != 0
-	|| parse_mount_string(NULL, &line) != 0)
+    if (parse_mount_string(bm, &me->root, &line) != 0
+	|| parse_mount_string(bm, &me->mount_point, &line) != 0
+	|| parse_mount_string(bm, NULL, &line) != 0)
 	goto error;
     do {
 	char *option;
 
-	if (parse_mount_string(&option, &line) != 0)
+	if (parse_mount_string(bm, &option, &line) != 0)
 	    goto error;
 	separator_found = strcmp(option, "-") == 0;
-	obstack_free(&mount_string_obstack, option);
+	obstack_free(&bm->mount_string_obstack, option);
     } while (!separator_found);
-    if (parse_mount_string(&me->fs_type, &line) != 0
-	|| parse_mount_string(&me->source, &line) != 0
-	|| parse_mount_string(NULL, &line) != 0)
+    if (parse_mount_string(bm, &me->fs_type, &line) != 0
+	|| parse_mount_string(bm, &me->source, &line) != 0
+	|| parse_mount_string(bm, NULL, &line) != 0)
 	goto error;
     return me;
 
 error:
     /* "line" is the only thing we really need to free, the strings in "me" will
        be freed when read_mount_entries starts again. */
-    obstack_free(&mount_data_obstack, me);
-    obstack_free(&mountinfo_line_obstack, line);
+    obstack_free(&bm->mount_data_obstack, me);
+    obstack_free(&bm->mountinfo_line_obstack, line);
     return NULL;
 }
 
-/* Read mount information from MOUNTINFO_PATH, update mount_entries and
-   num_mount_entries.
+/* Read mount information from MOUNTINFO_PATH, update bm->mount_entries and
+   bm->num_mount_entries.
    Return 0 if OK, -1 on error. */
 static int
-read_mount_entries(void)
+read_mount_entries(struct bind_mounts *bm)
 {
     FILE *f;
     struct mount *me;
@@ -268,31 +244,22 @@ read_mount_entries(void)
     f = fopen(MOUNTINFO_PATH, "r");
     if (f == NULL)
 	return -1;
-    obstack_free(&mount_data_obstack, mount_data_mark);
-    mount_data_mark = obstack_alloc(&mount_data_obstack, 0);
-    obstack_free(&mount_string_obstack, mount_string_mark);
-    mount_string_mark = obstack_alloc(&mount_string_obstack, 0);
-    obstack_free(&mount_list_obstack, mount_entries);
-    while ((me = read_mount_entry(f)) != NULL)
-	obstack_ptr_grow(&mount_list_obstack, me);
+    obstack_free(&bm->mount_data_obstack, bm->mount_data_mark);
+    bm->mount_data_mark = obstack_alloc(&bm->mount_data_obstack, 0);
+    obstack_free(&bm->mount_string_obstack, bm->mount_string_mark);
+    bm->mount_string_mark = obstack_alloc(&bm->mount_string_obstack, 0);
+    obstack_free(&bm->mount_list_obstack, bm->mount_entries);
+    while ((me = read_mount_entry(bm, f)) != NULL)
+	obstack_ptr_grow(&bm->mount_list_obstack, me);
     fclose(f);
-    num_mount_entries = OBSTACK_OBJECT_SIZE(&mount_list_obstack)
-	/ sizeof(*mount_entries);
-    mount_entries = obstack_finish(&mount_list_obstack);
+    bm->num_mount_entries = OBSTACK_OBJECT_SIZE(&bm->mount_list_obstack)
+	/ sizeof(*bm->mount_entries);
+    bm->mount_entries = obstack_finish(&bm->mount_list_obstack);
     return 0;
 }
 
  /* Bind mount path list maintenace and top-level interface. */
 
-/* MOUNTINFO_PATH file descriptor, or -1 */
-static int mountinfo_fd;
-
-/* Known bind mount paths */
-static struct string_list bind_mount_paths; /* = { 0, }; */
-
-static struct obstack bind_mount_paths_obstack;
-static void *bind_mount_paths_mark;
-
 /* Return a result of comparing A and B suitable for qsort() or bsearch() */
 static int
 cmp_ints(int a, int b)
@@ -349,27 +316,30 @@ cmp_string_pointer(const void *xa, const void *xb)
   return strcmp(a, *b);
 }
 
-/* Rebuild bind_mount_paths */
+/* Rebuild bm->bind_mount_paths */
 static void
-rebuild_bind_mount_paths(void)
+rebuild_bind_mount_paths(struct bind_mounts *bm)
 {
     size_t i;
 
-    if (read_mount_entries() != 0)
+    PROBE0(bind__mounts__start);
+    if (read_mount_entries(bm) != 0) {
+	PROBE1(bind__mounts__done, 0);
 	return;
-    obstack_free(&bind_mount_paths_obstack, bind_mount_paths_mark);
-    bind_mount_paths_mark = obstack_alloc(&bind_mount_paths_obstack, 0);
-    bind_mount_paths.len = 0;
+    }
+    obstack_free(&bm->bind_mount_paths_obstack, bm->bind_mount_paths_mark);
+    bm->bind_mount_paths_mark = obstack_alloc(&bm->bind_mount_paths_obstack, 0);
+    bm->bind_mount_paths.len = 0;
     /* Sort by ID to allow quick lookup */
-    qsort(mount_entries, num_mount_entries, sizeof (*mount_entries),
+    qsort(bm->mount_entries, bm->num_mount_entries, sizeof (*bm->mount_entries),
 	  cmp_mount_entry_pointers);
-    for (i = 0; i < num_mount_entries; i++) {
+    for (i = 0; i < bm->num_mount_entries; i++) {
 	struct mount *me, *parent;
 	void **pp;
 
-	me = mount_entries[i];
-	pp = bsearch(&me->parent_id, mount_entries, num_mount_entries,
-		     sizeof (*mount_entries), cmp_id_mount_entry);
+	me = bm->mount_entries[i];
+	pp = bsearch(&me->parent_id, bm->mount_entries, bm->num_mount_entries,
+		     sizeof (*bm->mount_entries), cmp_id_mount_entry);
 	if (pp == NULL)
 	    continue;
 	parent = *pp;
@@ -391,49 +361,67 @@ rebuild_bind_mount_paths(void)
 			  me->root + p_root_len) != 0) {
 		char *copy;
 
-		copy = obstack_copy(&bind_mount_paths_obstack, me->mount_point,
+		copy = obstack_copy(&bm->bind_mount_paths_obstack, me->mount_point,
 				    strlen(me->mount_point) + 1);
-		string_list_append(&bind_mount_paths, copy);
+		string_list_append(&bm->bind_mount_paths, copy);
 	    }
 	}
     }
-    qsort(bind_mount_paths.entries, bind_mount_paths.len,
-	  sizeof (*bind_mount_paths.entries), cmp_string_pointers);
+    qsort(bm->bind_mount_paths.entries, bm->bind_mount_paths.len,
+	  sizeof (*bm->bind_mount_paths.entries), cmp_string_pointers);
+    PROBE1(bind__mounts__done, bm->bind_mount_paths.len);
 }
 
-/* Return true if PATH is a destination of a bind mount.
+/* Return true if PATH is a destination of a bind mount, according to BM.
    (Bind mounts "to self" are ignored.) */
 bool
-is_bind_mount(const char *path)
+is_bind_mount(struct bind_mounts *bm, const char *path)
 {
     struct pollfd pfd;
 
     /* Unfortunately (mount --bind $path $path/subdir) would leave st_dev
        unchanged between $path and $path/subdir, so we must keep reparsing
        MOUNTINFO_PATH each time it changes. */
-    pfd.fd = mountinfo_fd;
+    pfd.fd = bm->mountinfo_fd;
     pfd.events = POLLPRI;
     if (poll(&pfd, 1, 0) < 0)
 	return false;
     if ((pfd.revents & POLLPRI) != 0) {
-	rebuild_bind_mount_paths();
+	rebuild_bind_mount_paths(bm);
     }
-    return bsearch(path, bind_mount_paths.entries, bind_mount_paths.len,
-		   sizeof (*bind_mount_paths.entries), cmp_string_pointer)
+    return bsearch(path, bm->bind_mount_paths.entries, bm->bind_mount_paths.len,
+		   sizeof (*bm->bind_mount_paths.entries), cmp_string_pointer)
 	!= NULL;
 }
 
-/* Initialize state for is_bind_mount(). */
+/* Initialize BM for is_bind_mount(). */
 void
-bind_mount_init(void)
+bind_mount_init(struct bind_mounts *bm)
 {
-  init_mount_entries();
-  obstack_init(&bind_mount_paths_obstack);
-  obstack_alignment_mask(&bind_mount_paths_obstack) = 0;
-  bind_mount_paths_mark = obstack_alloc(&bind_mount_paths_obstack, 0);
-  mountinfo_fd = open(MOUNTINFO_PATH, O_RDONLY);
-  if (mountinfo_fd == -1)
+  bm->bind_mount_paths.entries = NULL;
+  bm->bind_mount_paths.len = 0;
+  bm->bind_mount_paths.allocated = 0;
+  init_mount_entries(bm);
+  obstack_init(&bm->bind_mount_paths_obstack);
+  obstack_alignment_mask(&bm->bind_mount_paths_obstack) = 0;
+  bm->bind_mount_paths_mark = obstack_alloc(&bm->bind_mount_paths_obstack, 0);
+  bm->mountinfo_fd = open(MOUNTINFO_PATH, O_RDONLY);
+  if (bm->mountinfo_fd == -1)
     return;
-  rebuild_bind_mount_paths();
+  rebuild_bind_mount_paths(bm);
+}
+
+/* Free the state of BM. */
+void
+bind_mount_free(struct bind_mounts *bm)
+{
+  if (bm->mountinfo_fd != -1)
+    close(bm->mountinfo_fd);
+  free(bm->bind_mount_paths.entries);
+  obstack_free(&bm->bind_mount_paths_obstack, NULL);
+  obstack_free(&bm->mountinfo_line_obstack, NULL);
+  obstack_free(&bm->mount_list_obstack, NULL);
+  obstack_free(&bm->mount_string_obstack, NULL);
+  obstack_free(&bm->mount_data_obstack, NULL);
 }
 #endif /* __linux */
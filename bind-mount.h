@@ -27,23 +27,76 @@
 /* Use the same condition as in bind-mount.c! */
 #ifdef __linux
 
-/* Return true if PATH is a destination of a bind mount.
+#include <obstack.h>
+#include <stddef.h>
+
+/* A list of strings */
+struct string_list
+{
+    char **entries;
+    size_t len;			/* Number of valid entries */
+    /* Number of allocated entries, usually invalid after the list is "finished"
+       and ENTRIES are reallocated to the exact size. */
+    size_t allocated;
+};
+
+/* State of is_bind_mount() */
+struct bind_mounts
+{
+    /* Pointers to struct mount. */
+    void **mount_entries;
+    size_t num_mount_entries;
+    /* Obstack of struct mount entries. */
+    struct obstack mount_data_obstack;
+    void *mount_data_mark;
+    /* Obstack of strings referenced in mount entries. */
+    struct obstack mount_string_obstack;
+    void *mount_string_mark;
+    /* Obstack of 'void *' (struct mount *) pointers, for mount_entries */
+    struct obstack mount_list_obstack;
+    /* Obstack used for a MOUNTINFO_PATH line buffer */
+    struct obstack mountinfo_line_obstack;
+
+    /* MOUNTINFO_PATH file descriptor, or -1 */
+    int mountinfo_fd;
+    /* Known bind mount paths */
+    struct string_list bind_mount_paths;
+    struct obstack bind_mount_paths_obstack;
+    void *bind_mount_paths_mark;
+};
+
+/* Return true if PATH is a destination of a bind mount, according to BM.
    (Bind mounts "to self" are ignored.) */
-extern bool is_bind_mount(const char *path);
+extern bool is_bind_mount(struct bind_mounts *bm, const char *path);
 
-/* Initialize state for is_bind_mount(). */
-extern void bind_mount_init(void);
+/* Initialize BM for is_bind_mount(). */
+extern void bind_mount_init(struct bind_mounts *bm);
 
-#else /* !(defined(HAVE_MNTENT_H) && defined(HAVE_PATHS_H)) */
+/* Free the state of BM. */
+extern void bind_mount_free(struct bind_mounts *bm);
 
-static bool is_bind_mount(const char *path)
+#else /* !__linux */
+
+struct bind_mounts
+{
+    int unused;
+};
+
+static inline bool is_bind_mount(struct bind_mounts *bm, const char *path)
 {
+    (void)bm;
     (void)path;
     return false;
 }
 
-static void bind_mount_init(void)
+static inline void bind_mount_init(struct bind_mounts *bm)
+{
+    (void)bm;
+}
+
+static inline void bind_mount_free(struct bind_mounts *bm)
 {
+    (void)bm;
 }
 
 #endif /* __linux */
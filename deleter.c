@@ -0,0 +1,296 @@
+/* deleter.c -- removal of directory entries in a separate thread
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <config.h>
+
+#ifdef HAVE_PTHREAD_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "deleter.h"
+#include "probes.h"
+
+struct deleter_dir
+{
+    int fd;
+    struct timespec times[2];	/* atime and mtime to restore */
+    unsigned refs;		/* The caller's and one for each job */
+    int restore;		/* Restore times even if nothing was removed */
+    char path[];
+};
+
+/* A queued entry */
+struct job
+{
+    struct deleter_dir *dir;
+    char *name;
+    dev_t dev;
+    ino_t ino;
+    int is_dir;
+};
+
+struct deleter
+{
+    pthread_t thread;
+    /* Protects everything below, and refs and restore of all directories */
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+    struct job *jobs;		/* A ring of queue_len jobs */
+    size_t queue_len, head, count;
+    int stopping;		/* No more jobs will be queued */
+    struct deleter_failure *failures;
+    struct deleter_failure **failures_tail;
+};
+
+/* Record a failure to remove JOB with ERROR in D */
+static void
+add_failure(struct deleter *d, const struct job *job, int error)
+{
+    struct deleter_failure *f;
+    size_t path_size;
+
+    path_size = strlen(job->dir->path) + 1;
+    f = malloc(sizeof(*f) + path_size + strlen(job->name) + 1);
+    if (f == NULL)
+	return;
+    f->next = NULL;
+    f->is_dir = job->is_dir;
+    f->error = error;
+    memcpy(f->path, job->dir->path, path_size);
+    f->name = strcpy(f->path + path_size, job->name);
+    pthread_mutex_lock(&d->lock);
+    *d->failures_tail = f;
+    d->failures_tail = &f->next;
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* Drop a reference to DIR, with the lock of its deleter held.  REMOVED is
+   nonzero if an entry of DIR was removed. */
+static void
+release_dir(struct deleter_dir *dir, int removed)
+{
+    if (removed)
+	dir->restore = 1;
+    if (--dir->refs != 0)
+	return;
+    /* The directory was modified; don't let tmpwatch make it look recent */
+    if (dir->restore)
+	(void)futimens(dir->fd, dir->times);
+    close(dir->fd);
+    free(dir);
+}
+
+/* Remove the entry of JOB unless it was replaced since it was queued.
+   Return 1 if it was removed, 0 otherwise. */
+static int
+run_job(struct deleter *d, const struct job *job)
+{
+    struct stat sb;
+    int ret;
+
+    /* The directory is pinned by its descriptor; check the entry again */
+    if (fstatat(job->dir->fd, job->name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+	if (errno != ENOENT)
+	    add_failure(d, job, errno);
+	return 0;
+    }
+    if (sb.st_dev != job->dev || sb.st_ino != job->ino
+	|| (S_ISDIR(sb.st_mode) != 0) != job->is_dir) {
+	add_failure(d, job, 0);
+	return 0;
+    }
+    if (job->is_dir) {
+	PROBE2(rmdir__start, job->dir->path, job->name);
+	ret = unlinkat(job->dir->fd, job->name, AT_REMOVEDIR);
+	PROBE3(rmdir__done, job->dir->path, job->name, ret == 0);
+	/* Something was added; EBUSY is returned for a mount point. */
+	if (ret != 0 && errno != ENOENT && errno != ENOTEMPTY
+	    && errno != EEXIST && errno != EBUSY)
+	    add_failure(d, job, errno);
+    } else {
+	PROBE2(unlink__start, job->dir->path, job->name);
+	ret = unlinkat(job->dir->fd, job->name, 0);
+	PROBE3(unlink__done, job->dir->path, job->name, ret == 0);
+	if (ret != 0 && errno != ENOENT)
+	    add_failure(d, job, errno);
+    }
+    return ret == 0;
+}
+
+static void *
+deleter_thread(void *arg)
+{
+    struct deleter *d;
+
+    d = arg;
+    pthread_mutex_lock(&d->lock);
+    for (;;) {
+	struct job job;
+	int removed;
+
+	while (d->count == 0 && !d->stopping)
+	    pthread_cond_wait(&d->not_empty, &d->lock);
+	if (d->count == 0)
+	    break;
+	job = d->jobs[d->head];
+	d->head = (d->head + 1) % d->queue_len;
+	d->count--;
+	pthread_cond_signal(&d->not_full);
+	pthread_mutex_unlock(&d->lock);
+
+	removed = run_job(d, &job);
+	free(job.name);
+
+	pthread_mutex_lock(&d->lock);
+	release_dir(job.dir, removed);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return NULL;
+}
+
+struct deleter *
+deleter_start(size_t queue_len)
+{
+    struct deleter *d;
+    sigset_t all, old;
+    int err;
+
+    if (queue_len == 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    if ((d = calloc(1, sizeof(*d))) == NULL)
+	return NULL;
+    if ((d->jobs = calloc(queue_len, sizeof(*d->jobs))) == NULL) {
+	free(d);
+	return NULL;
+    }
+    d->queue_len = queue_len;
+    d->failures_tail = &d->failures;
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->not_empty, NULL);
+    pthread_cond_init(&d->not_full, NULL);
+    /* Signals are handled by the thread that walks the tree */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&d->thread, NULL, deleter_thread, d);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+	pthread_cond_destroy(&d->not_full);
+	pthread_cond_destroy(&d->not_empty);
+	pthread_mutex_destroy(&d->lock);
+	free(d->jobs);
+	free(d);
+	errno = err;
+	return NULL;
+    }
+    return d;
+}
+
+struct deleter_dir *
+deleter_dir_new(int fd, const char *path, const struct stat *sb)
+{
+    struct deleter_dir *dir;
+    size_t path_size;
+
+    path_size = strlen(path) + 1;
+    if ((dir = malloc(sizeof(*dir) + path_size)) == NULL)
+	return NULL;
+    if ((dir->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) == -1) {
+	free(dir);
+	return NULL;
+    }
+    dir->times[0] = sb->st_atim;
+    dir->times[1] = sb->st_mtim;
+    dir->refs = 1;
+    dir->restore = 0;
+    memcpy(dir->path, path, path_size);
+    return dir;
+}
+
+void
+deleter_dir_release(struct deleter *d, struct deleter_dir *dir, int restore)
+{
+    pthread_mutex_lock(&d->lock);
+    release_dir(dir, restore);
+    pthread_mutex_unlock(&d->lock);
+}
+
+int
+deleter_submit(struct deleter *d, struct deleter_dir *dir, const char *name,
+	       const struct stat *sb)
+{
+    struct job *job;
+    char *copy;
+
+    if ((copy = strdup(name)) == NULL)
+	return -1;
+    pthread_mutex_lock(&d->lock);
+    /* The queue bound keeps the walk from running away from the removals */
+    while (d->count == d->queue_len)
+	pthread_cond_wait(&d->not_full, &d->lock);
+    job = &d->jobs[(d->head + d->count) % d->queue_len];
+    job->dir = dir;
+    job->name = copy;
+    job->dev = sb->st_dev;
+    job->ino = sb->st_ino;
+    job->is_dir = S_ISDIR(sb->st_mode) != 0;
+    dir->refs++;
+    d->count++;
+    pthread_cond_signal(&d->not_empty);
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+struct deleter_failure *
+deleter_failures(struct deleter *d)
+{
+    struct deleter_failure *f;
+
+    pthread_mutex_lock(&d->lock);
+    f = d->failures;
+    d->failures = NULL;
+    d->failures_tail = &d->failures;
+    pthread_mutex_unlock(&d->lock);
+    return f;
+}
+
+struct deleter_failure *
+deleter_finish(struct deleter *d)
+{
+    struct deleter_failure *f;
+
+    pthread_mutex_lock(&d->lock);
+    d->stopping = 1;
+    pthread_cond_signal(&d->not_empty);
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->thread, NULL);
+
+    f = d->failures;
+    pthread_cond_destroy(&d->not_full);
+    pthread_cond_destroy(&d->not_empty);
+    pthread_mutex_destroy(&d->lock);
+    free(d->jobs);
+    free(d);
+    return f;
+}
+
+#endif /* HAVE_PTHREAD_H */
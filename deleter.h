@@ -0,0 +1,94 @@
+/* deleter.h -- removal of directory entries in a separate thread
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef DELETER_H__
+#define DELETER_H__
+
+#include <config.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/* A thread removing queued entries, in the order they were queued */
+struct deleter;
+
+/* An open directory that queued entries are in */
+struct deleter_dir;
+
+/* A queued entry that was not removed */
+struct deleter_failure
+{
+    struct deleter_failure *next;
+    int is_dir;
+    int error;			/* errno, or 0 if the entry was replaced */
+    const char *name;
+    char path[];		/* Of the directory */
+};
+
+/* Use the same condition as in deleter.c! */
+#ifdef HAVE_PTHREAD_H
+
+/* Start a thread removing the entries queued by deleter_submit(), with at
+   most QUEUE_LEN entries queued at a time.
+   Return NULL with errno set on error. */
+extern struct deleter *deleter_start(size_t queue_len);
+
+/* Return a directory for deleter_submit(): the open directory FD at PATH,
+   which is the inode of SB.  FD is duplicated.
+   Return NULL with errno set on error. */
+extern struct deleter_dir *deleter_dir_new(int fd, const char *path,
+					   const struct stat *sb);
+
+/* Drop the caller's reference to DIR of D.  When the entries queued in DIR
+   are finished too, its atime and mtime are set to those of the stat given
+   to deleter_dir_new() if RESTORE or if any of the entries was removed, and
+   it is closed. */
+extern void deleter_dir_release(struct deleter *d, struct deleter_dir *dir,
+				int restore);
+
+/* Queue NAME in DIR for removal by D, waiting while the queue is full.
+   NAME is removed only if it is still the inode of SB; directories are
+   removed only if they are empty.
+   Return 0 if OK, -1 with errno set. */
+extern int deleter_submit(struct deleter *d, struct deleter_dir *dir,
+			  const char *name, const struct stat *sb);
+
+/* Return the entries of D that were not removed since the last call,
+   oldest first; each is freed with free(). */
+extern struct deleter_failure *deleter_failures(struct deleter *d);
+
+/* Wait until all entries queued in D are finished, stop its thread and free
+   it.  Return the entries that were not removed, as deleter_failures(). */
+extern struct deleter_failure *deleter_finish(struct deleter *d);
+
+#else /* !HAVE_PTHREAD_H */
+
+static struct deleter *deleter_start(size_t queue_len)
+{
+    (void)queue_len;
+    errno = ENOSYS;
+    return NULL;
+}
+
+/* Never called without a deleter */
+#define deleter_dir_new(FD, PATH, SB) ((struct deleter_dir *)NULL)
+#define deleter_dir_release(D, DIR, RESTORE) ((void)0)
+#define deleter_submit(D, DIR, NAME, SB) (-1)
+#define deleter_failures(D) ((struct deleter_failure *)NULL)
+#define deleter_finish(D) ((struct deleter_failure *)NULL)
+
+#endif /* HAVE_PTHREAD_H */
+
+#endif
@@ -0,0 +1,3764 @@
+/* libtmpwatch.c -- remove old files in directory trees, but do it carefully.
+ *
+ * Copyright (C) 1997-2001, 2004-2009 Red Hat, Inc.  All rights reserved.
+ * Copyright (C) 2019-2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.  Any Red Hat
+ * trademarks that are incorporated in the source code or documentation are not
+ * subject to the GNU General Public License and may only be used or replicated
+ * with the express permission of Red Hat, Inc.
+ *
+ * Red Hat Author(s): Erik Troan <ewt@redhat.com>
+ *                    Preston Brown <pbrown@redhat.com>
+ *                    Mike A. Harris <mharris@redhat.com>
+ *                    Miloslav Trmac <mitr@redhat.com>
+ */
+#include <config.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <utime.h>
+#include <unistd.h>
+
+#ifdef HAVE_MNTENT_H
+#include <mntent.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef HAVE_PATHS_H
+#include <paths.h>
+#endif
+
+#include "bind-mount.h"
+#include "deleter.h"
+#include "libtmpwatch.h"
+#include "probes.h"
+#include "truncator.h"
+#include "unix-sockets.h"
+
+#ifdef __GNUC__
+#define attribute__(X) __attribute__ (X)
+#else
+#define attribute__(X)
+#endif
+
+/* Fields of struct stat that can decide the age of an entry */
+#define TIME_ATIME	(1 << 0)
+#define TIME_MTIME	(1 << 1)
+#define TIME_CTIME	(1 << 2)
+
+/* Operations of a filter program, built by compile_filters() from the
+   settings of a policy.  Each one rejects some of the entries of a directory;
+   checks that can never reject anything are left out of the program, and
+   cheap checks come first. */
+enum filter_op
+{
+    FILTER_END,			/* Accept the entry */
+    /* Before the age check, for all entries */
+    FILTER_DEVICE,		/* On a different device */
+    FILTER_ROOT_READONLY,	/* Non-writable and owned by root */
+    FILTER_LOST_FOUND,		/* lost+found owned by LOSTFOUND_UID */
+    FILTER_EXCLUSION,		/* --exclude */
+    FILTER_PATTERN,		/* --exclude-pattern */
+    /* After the age check, for entries other than directories */
+    FILTER_TYPE,		/* A file type we don't remove */
+    FILTER_UID,			/* --exclude-user */
+    FILTER_SPECIAL,		/* ext3 journal or quota file */
+    FILTER_FUSER,		/* In use according to fuser */
+    FILTER_MAX
+};
+
+/* TMPWATCH_KEPT_* for entries rejected by each FILTER_* */
+static const unsigned char filter_kept[FILTER_MAX] = {
+    [FILTER_DEVICE] = TMPWATCH_KEPT_DEVICE,
+    [FILTER_ROOT_READONLY] = TMPWATCH_KEPT_ROOT_READONLY,
+    [FILTER_LOST_FOUND] = TMPWATCH_KEPT_LOST_FOUND,
+    [FILTER_EXCLUSION] = TMPWATCH_KEPT_EXCLUDED,
+    [FILTER_PATTERN] = TMPWATCH_KEPT_PATTERN,
+    [FILTER_TYPE] = TMPWATCH_KEPT_TYPE,
+    [FILTER_UID] = TMPWATCH_KEPT_UID,
+    [FILTER_SPECIAL] = TMPWATCH_KEPT_SPECIAL,
+    [FILTER_FUSER] = TMPWATCH_KEPT_IN_USE,
+};
+
+/* Do not remove lost+found directories if owned by this UID */
+#define LOSTFOUND_UID 0
+
+/* The latest time_t, which is signed */
+#define TIME_T_MAX \
+    ((time_t)(((uintmax_t)1 << (sizeof(time_t) * CHAR_BIT - 1)) - 1))
+
+struct exclusion
+{
+    struct exclusion *next;
+    char *path;			/* Owns the memory of DIR and FILE */
+    const char *dir, *file;
+};
+
+struct excluded_pattern
+{
+    struct excluded_pattern *next;
+    char *pattern;
+};
+
+struct excluded_uid
+{
+    struct excluded_uid *next;
+    uid_t uid;
+};
+
+struct tmpwatch_policy
+{
+    struct tmpwatch_policy *next; /* In tmpwatch.policies */
+    char *root;			/* Absolute path, or NULL */
+    int flags;			/* TMPWATCH_* */
+    int grace;			/* in minutes */
+    time_t kill_time;
+    time_t socket_kill_time;	/* 0 = never */
+    struct exclusion *exclusions;
+    struct exclusion **exclusions_tail;
+    struct excluded_pattern *excluded_patterns;
+    struct excluded_pattern **excluded_patterns_tail;
+    struct excluded_uid *excluded_uids;
+    struct excluded_uid **excluded_uids_tail;
+    int visited;		/* The root has been cleaned up */
+    /* Of the root, recorded by tmpwatch_add_rule(); 0 if it didn't exist */
+    dev_t root_dev;
+    ino_t root_ino;
+    /* Built by compile_filters() */
+    int dir_fields, file_fields; /* TIME_* deciding the age of entries */
+    unsigned char filters[FILTER_MAX]; /* Terminated by FILTER_END */
+    unsigned char file_filters[FILTER_MAX];
+    /* name_key() of each name compared by FILTER_EXCLUSION and
+       FILTER_SPECIAL */
+    uint64_t names[256 / 64];
+};
+
+/* Files shredded by one run of shred at most, and runs at a time */
+#define SHRED_BATCH 32
+#define SHRED_JOBS 4
+
+/* A run of shred on files of the current directory */
+struct shred_job
+{
+    pid_t pid;
+    struct shred_wait
+    {
+	char *arg;		/* "./" and its name */
+	struct stat sb;
+	time_t time, threshold;	/* As in its struct tmpwatch_entry */
+	int reason;
+    } *files;			/* SHRED_BATCH of them allocated */
+    size_t len, bytes;		/* Files and their size as arguments */
+};
+
+/* An expired file waiting for fuser */
+struct fuser_wait
+{
+    char *arg;			/* "./" and its name */
+    struct stat sb;
+    time_t time, threshold;
+};
+
+struct tmpwatch
+{
+    int flags;			/* TMPWATCH_* */
+    const char *shred_path;
+    int log_level;
+    struct tmpwatch_callbacks callbacks;
+    void *data;			/* For callbacks */
+    time_t now;
+    time_t boot_time;		/* 0 = unknown */
+    struct tmpwatch_policy *policies; /* All policies, to free them */
+    /* Rules, sorted by root_dev and root_ino if rules_sorted */
+    struct tmpwatch_policy **rules;
+    size_t num_rules, rules_allocated;
+    int rules_sorted;
+    /* Set by tmpwatch_stop() */
+    volatile sig_atomic_t stop_requested;
+    /* The sweep was stopped; the unfinished directories are in frontier */
+    int interrupted;
+    int failed;			/* A TMPWATCH_LOG_FATAL message was reported */
+    /* The frontier of an interrupted sweep, innermost directory first until
+       the sweep returns */
+    struct tmpwatch_position *frontier;
+    size_t frontier_len, frontier_allocated;
+    /* The frontier to resume from, outermost directory first */
+    struct tmpwatch_position *resume_levels;
+    size_t num_resume_levels, resume_levels_allocated;
+    /* Number of resume_levels reached so far */
+    size_t resume_depth;
+    /* The directories being cleaned up, the current one last */
+    struct level *levels;
+    size_t num_levels, levels_allocated;
+    char *path;			/* Of the current directory */
+    size_t path_allocated;
+    size_t max_open_dirs, open_dirs; /* Of levels */
+    unsigned long removals;	/* Entries actually removed */
+    size_t pipeline_len;	/* 0 = remove entries at once */
+    struct deleter *deleter;	/* During a sweep with pipeline_len != 0 */
+    /* Regular files of truncate_size bytes or more are freed by truncator;
+       0 = remove them at once */
+    off_t truncate_size, truncate_step;
+    unsigned truncate_pause;
+    struct truncator *truncator; /* Started by the first such file */
+    /* Expired entries are moved to the directory named quarantine in the
+       root of each sweep, if not NULL; trash_fd is open during a sweep */
+    char *quarantine;
+    int trash_fd;
+    dev_t trash_dev;
+    ino_t trash_ino;
+    unsigned long trash_serial;	/* For names in the trash */
+    /* Expired files of the current directory waiting to be checked by one
+       run of fuser, with fuser_bytes of arguments */
+    struct fuser_wait *fuser_waiting;
+    size_t fuser_waiting_len, fuser_waiting_allocated, fuser_bytes;
+    /* Files of the current directory to be removed after shredding them:
+       shred_batch is being filled, shred_jobs are running, oldest first */
+    struct shred_job shred_batch;
+    struct shred_job shred_jobs[SHRED_JOBS];
+    size_t num_shred_jobs;
+    /* Entries at shard_depth below the root of a rule are divided into
+       shard_count shards, of which shard_index is cleaned up */
+    unsigned shard_index, shard_count, shard_depth;
+    /* Read when the first socket is checked with TMPWATCH_UNBOUND_SOCKETS */
+    struct unix_sockets unix_sockets;
+    struct bind_mounts bind_mounts; /* Of the mount table of the process */
+    const struct tmpwatch_fs_ops *fs; /* Access to the tree being swept */
+    void *fs_data;		/* For fs */
+    /* For tmpwatch_progress(), which may run in another thread: both are
+       protected by progress_lock */
+    struct tmpwatch_progress progress;
+    char *progress_path;
+    size_t progress_path_allocated;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t progress_lock;
+#endif
+};
+
+static void attribute__((format(printf, 3, 4)))
+  message(struct tmpwatch *tw, int level, const char *format, ...)
+{
+    va_list args;
+
+    if (level == TMPWATCH_LOG_FATAL)
+	tw->failed = 1;
+    if (level >= tw->log_level && tw->callbacks.log != NULL) {
+	va_start(args, format);
+	tw->callbacks.log(tw->data, level, format, args);
+	va_end(args);
+    }
+}
+
+/* Make PATH the directory reported by tmpwatch_progress() for TW */
+static void
+set_progress_path(struct tmpwatch *tw, const char *path)
+{
+    size_t size;
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&tw->progress_lock);
+#endif
+    size = strlen(path) + 1;
+    if (size > tw->progress_path_allocated) {
+	char *p;
+
+	if ((p = realloc(tw->progress_path, 2 * size)) != NULL) {
+	    tw->progress_path = p;
+	    tw->progress_path_allocated = 2 * size;
+	}
+    }
+    if (size <= tw->progress_path_allocated)
+	memcpy(tw->progress_path, path, size);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&tw->progress_lock);
+#endif
+}
+
+/* Add DIRS, ENTRIES, REMOVED and BYTES to the progress of TW */
+static void
+add_progress(struct tmpwatch *tw, unsigned long dirs, unsigned long entries,
+	     unsigned long removed, uintmax_t bytes)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&tw->progress_lock);
+#endif
+    tw->progress.dirs += dirs;
+    tw->progress.entries += entries;
+    tw->progress.removed += removed;
+    tw->progress.bytes += bytes;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&tw->progress_lock);
+#endif
+}
+
+/* Returns 0 if OK, 2 on ENOENT, 1 on other errors */
+static int
+safe_chdir(struct tmpwatch *tw, const char *fulldirname,
+	   const char *reldirname, dev_t st_dev, ino_t st_ino)
+{
+    struct stat sb1, sb2;
+
+    if (tw->fs->lstat(tw->fs_data, reldirname, &sb1)) {
+	if (errno == ENOENT)
+	    return 2;
+	message(tw, TMPWATCH_LOG_ERROR, "lstat() of directory %s failed: %s\n",
+		fulldirname, strerror(errno));
+	return 1;
+    }
+
+    if (! S_ISDIR(sb1.st_mode)) {
+	message(tw, TMPWATCH_LOG_ERROR,
+		"directory %s changed right under us!!!\n", fulldirname);
+	message(tw, TMPWATCH_LOG_FATAL,
+		"this indicates a possible intrusion attempt\n");
+	return 1;
+    }
+
+    /* Check if the directory changed between cleanupDirectory and
+     * safe_chdir
+     */
+    if (st_dev != sb1.st_dev || st_ino != sb1.st_ino) {
+	message(tw, TMPWATCH_LOG_ERROR,
+		"directory %s changed right under us!!!\n", fulldirname);
+	message(tw, TMPWATCH_LOG_FATAL,
+		"this indicates a possible intrusion attempt\n");
+	return 1;
+    }
+
+    if (tw->fs->chdir(tw->fs_data, reldirname) != 0) {
+	if (errno == ENOENT)
+	    return 2;
+	message(tw, TMPWATCH_LOG_ERROR, "chdir to directory %s failed: %s\n",
+		fulldirname, strerror(errno));
+	return 1;
+    }
+
+    if (tw->fs->lstat(tw->fs_data, ".", &sb2) != 0) {
+	message(tw, TMPWATCH_LOG_ERROR,
+		"second lstat() of directory %s failed: %s\n", fulldirname,
+		strerror(errno));
+	return 1;
+    }
+
+    if (sb1.st_dev != sb2.st_dev) {
+	message(tw, TMPWATCH_LOG_ERROR,
+		"device information changed for %s: %s!!!\n", fulldirname,
+		strerror(errno));
+	message(tw, TMPWATCH_LOG_FATAL,
+		"this indicates a possible intrusion attempt\n");
+	return 1;
+    } else if (sb1.st_ino != sb2.st_ino) {
+	message(tw, TMPWATCH_LOG_ERROR,
+		"inode information changed for %s: %s!!!\n", fulldirname,
+		strerror(errno));
+	message(tw, TMPWATCH_LOG_FATAL,
+		"this indicates a possible intrustion attempt\n");
+	return 1;
+    }
+
+    return 0;
+}
+
+#ifdef FUSER
+/* Arguments of fuser before the file names */
+#ifdef FUSER_ACCEPTS_S
+#define FUSER_OPTIONS 2
+#else
+#define FUSER_OPTIONS 1
+#endif
+
+/* Run fuser on the N files at ARGV + FUSER_OPTIONS, "./" followed by their
+   names; ARGV has room for the options before them and a NULL after them.
+   Return 1 if any of the files is in use, 0 if none is. */
+static int
+run_fuser(char **argv, size_t n)
+{
+    static int fuser_exists = -1;
+    static char *const empty_environ[] = { NULL };
+
+    int wstatus;			/* store return from waitpid */
+    int pid;
+
+    if (fuser_exists == -1)
+	fuser_exists = access(FUSER, R_OK | X_OK) == 0;
+    if (!fuser_exists)
+	return 0;
+
+    /* should we close all unnecessary file descriptors here? */
+
+    argv[0] = (char *)FUSER;
+#ifdef FUSER_ACCEPTS_S
+    argv[1] = (char *)"-s";
+#endif
+    argv[FUSER_OPTIONS + n] = NULL;
+    pid = fork();
+    if (pid == 0) {
+#ifndef FUSER_ACCEPTS_S
+	freopen("/dev/null", "w", stdout);
+	freopen("/dev/null", "w", stderr);
+#endif
+	execve(FUSER, argv, empty_environ);
+	_exit(127);
+    } else if (pid == -1 || waitpid(pid, &wstatus, 0) != pid)
+	return 1;
+
+    /* Even if a file is in use, WIFEXITED can still return a normal
+       termination; fuser exits with 0 if any of the files is in use, and an
+       abnormal exit counts as in use */
+    return !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) == 0;
+}
+
+/* check user function returns 0 if OK, 1 if file in use */
+static int
+check_fuser(const char *filename)
+{
+    char dir[2 + PATH_MAX];
+    char *argv[FUSER_OPTIONS + 2];
+    int ret;
+
+    PROBE1(fuser__start, filename);
+    /* Use "./" to protect against filenames starting with '-' */
+    snprintf(dir, sizeof(dir), "./%s", filename);
+    argv[FUSER_OPTIONS] = dir;
+    ret = run_fuser(argv, 1);
+    PROBE2(fuser__done, filename, ret);
+    return ret;
+}
+
+/* Set IN_USE[I] to whether the file ARGS[I] ("./" and its name) is in use,
+   for each I < N.  fuser only tells whether any of its files is in use, so
+   the files are run in one batch, split in halves only while a run finds
+   some of them in use.  ARGV has room for N files after the options. */
+static void
+check_fuser_batch(char **argv, char *const *args, size_t n,
+		  unsigned char *in_use)
+{
+    int ret;
+
+    PROBE2(fuser__batch__start, args[0] + 2, n);
+    memcpy(argv + FUSER_OPTIONS, args, n * sizeof(*args));
+    ret = run_fuser(argv, n);
+    PROBE3(fuser__batch__done, args[0] + 2, n, ret);
+    if (!ret)
+	memset(in_use, 0, n);
+    else if (n == 1)
+	in_use[0] = 1;
+    else {
+	check_fuser_batch(argv, args, n / 2, in_use);
+	check_fuser_batch(argv, args + n / 2, n - n / 2, in_use + n / 2);
+    }
+}
+#else
+#define check_fuser(FILENAME) 0
+#endif
+
+#ifndef O_NOATIME
+#define O_NOATIME 0
+#endif
+
+#ifdef F_SETLEASE
+
+/* Return 1 if the regular file NAME, the inode of SB, is open in another
+   process, 0 if it is not, -1 if this can not be determined by a lease.
+   The kernel grants a write lease only to the sole opener of a file, so this
+   costs an open() and two fcntl() calls instead of a fork() of fuser. */
+static int
+check_lease(const char *name, const struct stat *sb)
+{
+    struct stat sb2;
+    int fd, ret;
+
+    fd = open(name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_NOATIME);
+    /* O_NOATIME is refused for files we don't own without CAP_FOWNER */
+    if (fd == -1 && errno == EPERM && O_NOATIME != 0)
+	fd = open(name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY);
+    if (fd == -1)
+	/* With O_NONBLOCK, a lease held by someone else fails the open() */
+	return errno == EWOULDBLOCK ? 1 : -1;
+    if (fstat(fd, &sb2) != 0 || sb2.st_dev != sb->st_dev
+	|| sb2.st_ino != sb->st_ino)
+	ret = -1;
+    else if (fcntl(fd, F_SETLEASE, F_WRLCK) == 0) {
+	fcntl(fd, F_SETLEASE, F_UNLCK);
+	ret = 0;
+    } else if (errno == EAGAIN)
+	ret = 1;
+    else
+	/* EINVAL if the filesystem doesn't support leases, EACCES if we
+	   neither own the file nor have CAP_LEASE */
+	ret = -1;
+    close(fd);
+    return ret;
+}
+#endif
+
+/* Return 1 if NAME, the inode of SB, is in use, 0 if not, -1 if only
+   fuser can tell */
+static int
+lease_in_use(const char *name, const struct stat *sb)
+{
+#ifdef F_SETLEASE
+    if (S_ISREG(sb->st_mode))
+	return check_lease(name, sb);
+#else
+    (void)name;
+    (void)sb;
+#endif
+    return -1;
+}
+
+/* Return 1 if NAME, the inode of SB, is in use, 0 if not */
+static int
+file_in_use(const char *name, const struct stat *sb)
+{
+    int ret;
+
+    ret = lease_in_use(name, sb);
+    if (ret != -1)
+	return ret;
+    return check_fuser(name);
+}
+
+/* Return the TIME_* fields that decide the age of an entry under FLAGS;
+   IS_DIR selects the rules for directories. */
+static int
+significant_fields(int flags, int is_dir)
+{
+    int fields;
+
+    fields = 0;
+    if ((flags & TMPWATCH_DIRMTIME) != 0 && is_dir)
+	fields |= TIME_MTIME;
+    /* The else here (and not elsewhere) is intentional */
+    else if ((flags & TMPWATCH_ATIME) != 0)
+	fields |= TIME_ATIME;
+    if ((flags & TMPWATCH_MTIME) != 0)
+	fields |= TIME_MTIME;
+    if ((flags & TMPWATCH_CTIME) != 0) {
+	/* Even when we were told to use ctime, for directories we use
+	   mtime, because when a file in a directory is deleted, its
+	   ctime will change, and there's no way we can change it
+	   back.  Therefore, we use mtime rather than ctime so that
+	   directories won't hang around for a long time after their
+	   contents are removed. */
+	if (is_dir)
+	    fields |= TIME_MTIME;
+	else
+	    fields |= TIME_CTIME;
+    }
+    return fields;
+}
+
+/* Return the significant time of SB: the latest of its FIELDS (not 0) */
+static time_t
+entry_time(const struct stat *sb, int fields)
+{
+    time_t t;
+
+    switch (fields) {
+    case TIME_ATIME:
+	return sb->st_atime;
+    case TIME_MTIME:
+	return sb->st_mtime;
+    case TIME_CTIME:
+	return sb->st_ctime;
+    }
+    /* At least two fields are selected */
+    t = (fields & TIME_MTIME) != 0 ? sb->st_mtime : sb->st_ctime;
+    if ((fields & TIME_ATIME) != 0 && sb->st_atime > t)
+	t = sb->st_atime;
+    if ((fields & TIME_CTIME) != 0 && sb->st_ctime > t)
+	t = sb->st_ctime;
+    return t;
+}
+
+#ifdef __linux
+static int
+is_mount_point(struct tmpwatch *tw, const char *path)
+{
+    FILE *fp;
+    struct mntent *mnt;
+    int ret;
+
+    if ((fp = setmntent(_PATH_MOUNTED, "r")) == NULL) {
+	message(tw, TMPWATCH_LOG_ERROR, "failed to open %s for reading\n",
+		_PATH_MOUNTED);
+	return -1;
+    }
+
+    ret = 0;
+    while ((mnt = getmntent(fp)) != NULL) {
+	if (strcmp(mnt->mnt_dir, path) == 0) {
+	    ret = 1;
+	    break;
+	}
+    }
+    endmntent(fp);
+
+    return ret;
+}
+#endif
+
+/* Return a key of NAME, from its first two bytes.  Names with different
+   keys are different, so most entries are told apart from the few names the
+   filters look for without comparing whole strings. */
+static unsigned
+name_key(const char *name)
+{
+    const unsigned char *p;
+
+    p = (const unsigned char *)name;
+    /* p[1] is the terminating NUL of one-byte names */
+    return (p[0] * 31 + p[1]) & 0xFF;
+}
+
+/* Add NAME to the names of POLICY */
+static void
+add_policy_name(struct tmpwatch_policy *policy, const char *name)
+{
+    unsigned key;
+
+    key = name_key(name);
+    policy->names[key / 64] |= UINT64_C(1) << (key % 64);
+}
+
+/* Return nonzero if NAME may be one of the names of POLICY */
+static int
+policy_name(const struct tmpwatch_policy *policy, const char *name)
+{
+    unsigned key;
+
+    key = name_key(name);
+    return (policy->names[key / 64] >> (key % 64)) & 1;
+}
+
+/* Per-directory state of run_filter() */
+struct filter_dir
+{
+    struct tmpwatch *tw;
+    const char *fulldirname;
+    dev_t st_dev;
+    int has_exclusions;		/* An exclusion names an entry in here */
+    /* FILTER_FUSER leaves the files that only fuser can check to the caller,
+       setting fuser_deferred for each of them */
+    int batch_fuser, fuser_deferred;
+    char *path;			/* "FULLDIRNAME/ENTRY" for FILTER_PATTERN */
+    size_t dir_len, path_size;
+};
+
+/* Prepare FD for entries of FULLDIRNAME on ST_DEV under POLICY */
+static void
+filter_dir_init(struct filter_dir *fd, struct tmpwatch *tw,
+		const struct tmpwatch_policy *policy, const char *fulldirname,
+		dev_t st_dev)
+{
+    const struct exclusion *e;
+
+    fd->tw = tw;
+    fd->fulldirname = fulldirname;
+    fd->st_dev = st_dev;
+    fd->has_exclusions = 0;
+    fd->batch_fuser = 0;
+    fd->fuser_deferred = 0;
+    for (e = policy->exclusions; e != NULL; e = e->next) {
+	if (strcmp(fulldirname, e->dir) == 0) {
+	    fd->has_exclusions = 1;
+	    break;
+	}
+    }
+    fd->path = NULL;
+    fd->dir_len = strlen(fulldirname);
+    fd->path_size = 0;
+}
+
+static void
+filter_dir_free(struct filter_dir *fd)
+{
+    free(fd->path);
+}
+
+/* Run filter program OPS of POLICY on entry NAME of FD, described by SB.
+   Return the operation that rejected the entry, or FILTER_END. */
+static int
+run_filter(const unsigned char *ops, const struct tmpwatch_policy *policy,
+	   struct filter_dir *fd, const char *name, const struct stat *sb)
+{
+    for (;; ops++) {
+	switch (*ops) {
+	case FILTER_END:
+	    return FILTER_END;
+
+	case FILTER_DEVICE:
+	    /* One more check for a different device.  Try hard not to go onto
+	       a different device. */
+	    if (sb->st_dev != fd->st_dev) {
+		message(fd->tw, TMPWATCH_LOG_VERBOSE,
+			"file on different device skipped: %s\n", name);
+		return *ops;
+	    }
+	    break;
+
+	case FILTER_ROOT_READONLY:
+	    if (sb->st_uid == 0 && (sb->st_mode & S_IWUSR) == 0) {
+		message(fd->tw, TMPWATCH_LOG_DEBUG, "non-writeable file owned "
+			"by root skipped: %s\n", name);
+		return *ops;
+	    }
+	    break;
+
+	case FILTER_LOST_FOUND:
+	    /*
+	     * skip over directories named lost+found that are owned by
+	     * LOSTFOUND_UID (root)
+	     */
+	    if (sb->st_uid == LOSTFOUND_UID && S_ISDIR(sb->st_mode)
+		&& strcmp(name, "lost+found") == 0)
+		return *ops;
+	    break;
+
+	case FILTER_EXCLUSION:
+	    if (fd->has_exclusions && policy_name(policy, name)) {
+		const struct exclusion *e;
+
+		for (e = policy->exclusions; e != NULL; e = e->next) {
+		    if (strcmp(name, e->file) == 0
+			&& strcmp(fd->fulldirname, e->dir) == 0) {
+			message(fd->tw, TMPWATCH_LOG_REALDEBUG,
+				"in exclusion list, skipping\n");
+			return *ops;
+		    }
+		}
+	    }
+	    break;
+
+	case FILTER_PATTERN: {
+	    const struct excluded_pattern *ep;
+	    size_t size;
+
+	    size = fd->dir_len + strlen(name) + 2;
+	    if (size > fd->path_size) {
+		char *p;
+
+		if ((p = realloc(fd->path, size)) == NULL)
+		    return *ops;
+		fd->path = p;
+		fd->path_size = size;
+		p = stpcpy(p, fd->fulldirname);
+		*p = '/';
+	    }
+	    strcpy(fd->path + fd->dir_len + 1, name);
+	    for (ep = policy->excluded_patterns; ep != NULL; ep = ep->next) {
+		if (fnmatch(ep->pattern, fd->path,
+			    FNM_PATHNAME | FNM_PERIOD) == 0) {
+		    message(fd->tw, TMPWATCH_LOG_REALDEBUG,
+			    "matches exclusion pattern, skipping\n");
+		    return *ops;
+		}
+	    }
+	    break;
+	}
+
+	case FILTER_TYPE:
+	    if (!S_ISREG(sb->st_mode) && !S_ISSOCK(sb->st_mode)
+		&& ((policy->flags & TMPWATCH_NOSYMLINKS) != 0
+		    || !S_ISLNK(sb->st_mode)))
+		return *ops;
+	    break;
+
+	case FILTER_UID: {
+	    const struct excluded_uid *u;
+
+	    for (u = policy->excluded_uids; u != NULL; u = u->next) {
+		if (sb->st_uid == u->uid) {
+		    message(fd->tw, TMPWATCH_LOG_REALDEBUG,
+			    "file owner excluded, skipping\n");
+		    return *ops;
+		}
+	    }
+	    break;
+	}
+
+#ifdef __linux
+	case FILTER_SPECIAL:
+	    /* check if it is an ext3 journal file */
+	    if (policy_name(policy, name)
+		&& ((strcmp(name, ".journal") == 0 && sb->st_uid == 0)
+		    || strcmp(name, "aquota.user") == 0
+		    || strcmp(name, "aquota.group") == 0)) {
+		int mount;
+
+		mount = is_mount_point(fd->tw, fd->fulldirname);
+		if (mount == -1)
+		    return *ops;
+		if (mount != 0) {
+		    message(fd->tw, TMPWATCH_LOG_VERBOSE,
+			    "skipping %s file: %s/%s\n",
+			    name[0] == '.' ? "ext3 journal" : "quota",
+			    fd->fulldirname, name);
+		    return *ops;
+		}
+	    }
+	    break;
+#endif
+
+	case FILTER_FUSER: {
+	    int in_use;
+
+	    in_use = lease_in_use(name, sb);
+	    if (in_use == -1 && fd->batch_fuser) {
+		fd->fuser_deferred = 1;
+		break;
+	    }
+	    if (in_use == -1)
+		in_use = check_fuser(name);
+	    if (in_use) {
+		message(fd->tw, TMPWATCH_LOG_VERBOSE,
+			"file is already in use or open: %s/%s\n",
+			fd->fulldirname, name);
+		return *ops;
+	    }
+	    break;
+	}
+
+	default:
+	    abort();
+	}
+    }
+}
+
+/* Return the size of the file arguments, with their pointers, given to one
+   run of fuser or shred at most; half of ARG_MAX leaves room for the rest of
+   the arguments */
+static size_t
+args_size_max(void)
+{
+    static long arg_max;
+
+    if (arg_max == 0) {
+	arg_max = sysconf(_SC_ARG_MAX);
+	if (arg_max < _POSIX_ARG_MAX)
+	    arg_max = _POSIX_ARG_MAX;
+    }
+    return arg_max / 2;
+}
+
+#ifdef SEEK_DATA
+/* Overwrite passes, as done by shred by default */
+#define SHRED_PASSES 3
+#define SHRED_BUFFER_SIZE (64 * 1024)
+
+/* Overwrite the data of NAME, the inode of EXAMINED, in the current directory
+   FULLDIRNAME with random bytes if it is a sparse regular file, skipping its
+   holes: overwriting them would allocate the whole file, which may fill the
+   filesystem.
+   Return 1 if NAME was shredded, 0 if shred should be used instead, -1 if
+   NAME is no longer EXAMINED or shredding it failed after starting to
+   write. */
+static int
+shred_extents(struct tmpwatch *tw, const char *fulldirname, const char *name,
+	      const struct stat *examined)
+{
+    struct stat sb;
+    off_t data, hole;
+    char *buffer;
+    int fd, random_fd, pass, ret;
+
+    fd = open(name, O_WRONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY);
+    if (fd == -1)
+	return 0;
+    random_fd = -1;
+    buffer = NULL;
+    ret = 0;
+    if (fstat(fd, &sb) != 0)
+	goto out;
+    if (sb.st_dev != examined->st_dev || sb.st_ino != examined->st_ino) {
+	message(tw, TMPWATCH_LOG_VERBOSE,
+		"%s/%s changed since it was examined, not removing it\n",
+		fulldirname, name);
+	ret = -1;
+	goto out;
+    }
+    if (!S_ISREG(sb.st_mode) || (off_t)sb.st_blocks * 512 >= sb.st_size)
+	goto out;
+    /* EINVAL if the filesystem can't tell where the holes are */
+    if (lseek(fd, 0, SEEK_DATA) == -1 && errno != ENXIO)
+	goto out;
+    if ((buffer = malloc(SHRED_BUFFER_SIZE)) == NULL
+	|| (random_fd = open("/dev/urandom", O_RDONLY)) == -1)
+	goto out;
+
+    ret = 1;
+    message(tw, TMPWATCH_LOG_DEBUG,
+	    "shredding %jd allocated bytes of %jd in %s/%s\n",
+	    (intmax_t)sb.st_blocks * 512, (intmax_t)sb.st_size, fulldirname,
+	    name);
+    for (pass = 0; pass < SHRED_PASSES; pass++) {
+	hole = 0;
+	for (;;) {
+	    data = lseek(fd, hole, SEEK_DATA);
+	    if (data == -1) {
+		if (errno == ENXIO) /* No more data */
+		    break;
+		goto error;
+	    }
+	    hole = lseek(fd, data, SEEK_HOLE);
+	    if (hole == -1)
+		goto error;
+	    while (data < hole) {
+		size_t size;
+		ssize_t done;
+
+		size = SHRED_BUFFER_SIZE;
+		if ((off_t)size > hole - data)
+		    size = hole - data;
+		done = read(random_fd, buffer, size);
+		if (done <= 0)
+		    goto error;
+		done = pwrite(fd, buffer, done, data);
+		if (done <= 0)
+		    goto error;
+		data += done;
+	    }
+	}
+	/* Each pass must reach the disk, not only the page cache */
+	if (fdatasync(fd) != 0)
+	    goto error;
+    }
+    goto out;
+
+error:
+    message(tw, TMPWATCH_LOG_ERROR,
+	    "failed to shred %s/%s: %s, not removing it\n", fulldirname, name,
+	    strerror(errno));
+    ret = -1;
+out:
+    if (random_fd != -1)
+	close(random_fd);
+    free(buffer);
+    close(fd);
+    return ret;
+}
+#else
+#define shred_extents(TW, FULLDIRNAME, NAME, EXAMINED) 0
+#endif
+
+/* Start shred on the N files ARGS ("./" and their names) of the current
+   directory.
+   Return its process ID, or -1 with errno set. */
+static pid_t
+spawn_shred(struct tmpwatch *tw, char *const *args, size_t n)
+{
+    char **argv;
+    char options[4];		/* -v, -f, -vf or nothing */
+    size_t i;
+    pid_t pid;
+    int err;
+
+    if ((argv = malloc((n + 3) * sizeof(*argv))) == NULL)
+	return -1;
+    i = 0;
+    argv[i++] = (char *)"shred";
+    /* use shred verbosity according to log_level */
+    /* force file shred if required */
+    strcpy(options, "-");
+    if (tw->log_level < TMPWATCH_LOG_NORMAL)
+	strcat(options, "v");
+    if (tw->flags & TMPWATCH_FORCE)
+	strcat(options, "f");
+    if (options[1] != '\0')
+	argv[i++] = options;
+    memcpy(argv + i, args, n * sizeof(*args));
+    argv[i + n] = NULL;
+    err = posix_spawn(&pid, tw->shred_path, NULL, NULL, argv, environ);
+    free(argv);
+    if (err != 0) {
+	errno = err;
+	return -1;
+    }
+    return pid;
+}
+
+/* Wait for PID, a run of shred.
+   Return 1 if it succeeded, 0 if it failed. */
+static int
+wait_shred(pid_t pid)
+{
+    int wstatus;
+
+    while (waitpid(pid, &wstatus, 0) != pid) {
+	if (errno != EINTR)
+	    return 0;
+    }
+    return WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+}
+
+static int queue_shred(struct tmpwatch *tw,
+		       const struct tmpwatch_entry *entry);
+
+/* Shred the file of ENTRY, in the current directory.
+   Return 1 if it is queued to be shredded and removed with the other files
+   of a sweep of the directory, 0 if it is to be removed now, -1 if
+   shredding it failed. */
+static int
+shred_file(struct tmpwatch *tw, const struct tmpwatch_entry *entry)
+{
+    const char *fulldirname, *name;
+    char *arg;
+    pid_t pid;
+
+    fulldirname = entry->dir;
+    name = entry->name;
+    message(tw, TMPWATCH_LOG_VERBOSE, "shredding file %s/%s\n",
+	    fulldirname, name);
+    switch (shred_extents(tw, fulldirname, name, entry->stat)) {
+    case 1:
+	return 0;
+    case -1:
+	return -1;
+    }
+    if (tw->num_levels != 0 && queue_shred(tw, entry) == 0)
+	return 1;
+    if (asprintf(&arg, "./%s", name) == -1)
+	return -1;
+    pid = spawn_shred(tw, &arg, 1);
+    free(arg);
+    if (pid == -1) {
+	/* something went wrong */
+	message(tw, TMPWATCH_LOG_ERROR, "cannot run %s: %s.  No shredding "
+		"will occur for files.\n", tw->shred_path, strerror(errno));
+	return 0;
+    }
+    if (!wait_shred(pid)) {
+	message(tw, TMPWATCH_LOG_ERROR, "shred failed for %s/%s, not "
+		"removing it\n", fulldirname, name);
+	return -1;
+    }
+    return 0;
+}
+
+static int queue_removal(struct tmpwatch *tw, const char *fulldirname,
+			 const char *name, const struct stat *sb);
+
+/* Move NAME, the inode of SB, in the current directory FULLDIRNAME to the
+   quarantine of the sweep.
+   Return 1 if NAME is gone, 0 if it could not be moved, -1 if it must be
+   removed as usual. */
+static int
+quarantine_file(struct tmpwatch *tw, const char *fulldirname,
+		const char *name, const struct stat *sb)
+{
+    char trash_name[64];
+    int res;
+
+    do {
+	snprintf(trash_name, sizeof(trash_name), "%jx.%lx",
+		 (uintmax_t)sb->st_ino, tw->trash_serial++);
+#ifdef HAVE_RENAMEAT2
+	res = renameat2(AT_FDCWD, name, tw->trash_fd, trash_name,
+			RENAME_NOREPLACE);
+#else
+	{
+	    struct stat sb2;
+
+	    /* Nobody else can add entries to the quarantine */
+	    if (fstatat(tw->trash_fd, trash_name, &sb2,
+			AT_SYMLINK_NOFOLLOW) == 0) {
+		errno = EEXIST;
+		res = -1;
+	    } else
+		res = renameat(AT_FDCWD, name, tw->trash_fd, trash_name);
+	}
+#endif
+    } while (res != 0 && errno == EEXIST);
+    if (res != 0) {
+	/* EINVAL if the filesystem doesn't support RENAME_NOREPLACE, EXDEV
+	   below a mount point */
+	if (errno == EINVAL || errno == EXDEV)
+	    return -1;
+	if (errno == ENOENT)
+	    return 1;
+	message(tw, TMPWATCH_LOG_ERROR, "failed to move %s/%s to the "
+		"quarantine: %s\n", fulldirname, name, strerror(errno));
+	return 0;
+    }
+    message(tw, TMPWATCH_LOG_DEBUG, "moved %s/%s to the quarantine as %s\n",
+	    fulldirname, name, trash_name);
+    tw->removals++;
+    return 1;
+}
+
+/* Files queued in tw->truncator at a time */
+#define TRUNCATE_QUEUE_LEN 16
+
+#ifdef F_SETLEASE
+/* Unlink the large regular file NAME, the inode of SB, in the current
+   directory FULLDIRNAME, leaving its blocks to be freed gradually by
+   tw->truncator.  This is done only if nobody else has NAME open, as shown
+   by a write lease, and if NAME has no other links.
+   Return 1 if NAME is gone, 0 if it could not be removed, -1 if it must be
+   removed as usual. */
+static int
+remove_gradually(struct tmpwatch *tw, const char *fulldirname,
+		 const char *name, const struct stat *sb)
+{
+    struct stat sb2;
+    int fd;
+
+    if (tw->truncator == NULL) {
+	tw->truncator = truncator_start(TRUNCATE_QUEUE_LEN, tw->truncate_step,
+					tw->truncate_pause);
+	if (tw->truncator == NULL) {
+	    message(tw, TMPWATCH_LOG_ERROR, "cannot start truncating files "
+		    "in a separate thread: %s\n", strerror(errno));
+	    tw->truncate_size = 0;
+	    return -1;
+	}
+    }
+    fd = open(name, O_WRONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (fd == -1)
+	return -1;
+    /* Truncating a file someone else uses would destroy their data, while
+       unlinking it would not */
+    if (fstat(fd, &sb2) != 0 || sb2.st_dev != sb->st_dev
+	|| sb2.st_ino != sb->st_ino || sb2.st_nlink != 1
+	|| fcntl(fd, F_SETLEASE, F_WRLCK) != 0) {
+	close(fd);
+	return -1;
+    }
+    PROBE2(unlink__start, fulldirname, name);
+    if (unlink(name) != 0) {
+	int err;
+
+	err = errno;
+	PROBE3(unlink__done, fulldirname, name, 0);
+	close(fd);
+	if (err == ENOENT)
+	    return 1;
+	message(tw, TMPWATCH_LOG_ERROR, "failed to unlink %s/%s: %s\n",
+		fulldirname, name, strerror(err));
+	return 0;
+    }
+    PROBE3(unlink__done, fulldirname, name, 1);
+    tw->removals++;
+    /* Nobody can open NAME now; a lease break in the meantime sent us
+       SIGIO */
+    fcntl(fd, F_SETLEASE, F_UNLCK);
+    if (fstat(fd, &sb2) != 0 || sb2.st_nlink != 0) {
+	/* Linked again meanwhile */
+	close(fd);
+	return 1;
+    }
+    message(tw, TMPWATCH_LOG_DEBUG, "freeing %jd bytes of %s/%s gradually\n",
+	    (intmax_t)sb2.st_size, fulldirname, name);
+    truncator_submit(tw->truncator, fd, sb2.st_size);
+    return 1;
+}
+#else
+#define remove_gradually(TW, FULLDIRNAME, NAME, SB) (-1)
+#endif
+
+/* Remove file NAME, the inode of SB, in the current directory FULLDIRNAME,
+   unless TMPWATCH_TEST.
+   Return 1 if NAME is gone (or would be with TMPWATCH_TEST, or is queued for
+   tw->deleter), 0 otherwise. */
+static int
+unlink_file(struct tmpwatch *tw, const char *fulldirname, const char *name,
+	    const struct stat *sb)
+{
+    message(tw, TMPWATCH_LOG_VERBOSE, "removing file %s/%s\n", fulldirname,
+	    name);
+    if ((tw->flags & TMPWATCH_TEST) != 0)
+	return 1;
+    if (tw->trash_fd != -1) {
+	int gone;
+
+	gone = quarantine_file(tw, fulldirname, name, sb);
+	if (gone != -1)
+	    return gone;
+    }
+    if (tw->truncate_size != 0 && S_ISREG(sb->st_mode)
+	&& sb->st_size >= tw->truncate_size) {
+	int gone;
+
+	gone = remove_gradually(tw, fulldirname, name, sb);
+	if (gone != -1)
+	    return gone;
+    }
+    if (tw->deleter != NULL && queue_removal(tw, fulldirname, name, sb) == 0)
+	return 1;
+
+    PROBE2(unlink__start, fulldirname, name);
+    if (tw->fs->unlink(tw->fs_data, name) != 0 && errno != ENOENT) {
+	PROBE3(unlink__done, fulldirname, name, 0);
+	message(tw, TMPWATCH_LOG_ERROR, "failed to unlink %s/%s: %s\n",
+		fulldirname, name, strerror(errno));
+	return 0;
+    }
+    PROBE3(unlink__done, fulldirname, name, 1);
+    tw->removals++;
+    return 1;
+}
+
+/* Returned by remove_file() for a file queued to be shredded; it is
+   counted and reported by remove_shredded() when it is removed */
+#define REMOVE_QUEUED 2
+
+/* Remove (and shred if requested) the file of ENTRY, in the current
+   directory, unless TMPWATCH_TEST.
+   Return 1 if it is gone (or would be with TMPWATCH_TEST, or is queued for
+   tw->deleter), REMOVE_QUEUED if it is queued for shred, 0 otherwise. */
+static int
+remove_file(struct tmpwatch *tw, const struct tmpwatch_entry *entry)
+{
+    /* shred files if requested */
+    if ((tw->flags & (TMPWATCH_SHRED | TMPWATCH_TEST)) == TMPWATCH_SHRED
+	&& tw->shred_path != NULL) {
+	switch (shred_file(tw, entry)) {
+	case 1:
+	    return REMOVE_QUEUED;
+	case -1:
+	    return 0;
+	}
+    }
+    return unlink_file(tw, entry->dir, entry->name, entry->stat);
+}
+
+/* Remove directory NAME, the inode of SB, in the current directory
+   FULLDIRNAME if it is empty, unless TMPWATCH_TEST.
+   Return 1 if NAME is gone (or would be with TMPWATCH_TEST, or is queued for
+   tw->deleter), 0 otherwise. */
+static int
+remove_directory(struct tmpwatch *tw, const char *fulldirname,
+		 const char *name, const struct stat *sb)
+{
+    message(tw, TMPWATCH_LOG_VERBOSE, "removing directory %s/%s if empty\n",
+	    fulldirname, name);
+    if ((tw->flags & TMPWATCH_TEST) != 0)
+	return 1;
+    if (tw->deleter != NULL && queue_removal(tw, fulldirname, name, sb) == 0)
+	return 1;
+
+    PROBE2(rmdir__start, fulldirname, name);
+    if (tw->fs->rmdir(tw->fs_data, name)) {
+	PROBE3(rmdir__done, fulldirname, name, errno == ENOENT);
+	if (errno == ENOENT)
+	    return 1;
+	/* EBUSY is returned for a mount point. */
+	if (errno != ENOTEMPTY && errno != EBUSY) {
+	    message(tw, TMPWATCH_LOG_ERROR, "failed to rmdir %s/%s: %s\n",
+		    fulldirname, name, strerror(errno));
+	}
+	return 0;
+    }
+    PROBE3(rmdir__done, fulldirname, name, 1);
+    tw->removals++;
+    return 1;
+}
+
+/* Remove ENTRY of the current directory, unless the decide callback takes
+   care of it.
+   Return 1 if ENTRY is gone (or would be with TMPWATCH_TEST, or is left to
+   the caller), 0 otherwise. */
+static int
+remove_entry(struct tmpwatch *tw, const struct tmpwatch_entry *entry)
+{
+    int gone;
+
+    PROBE3(entry__expired, entry->dir, entry->name, entry->reason);
+    if (tw->callbacks.decide != NULL) {
+	switch (tw->callbacks.decide(tw->data, entry)) {
+	case TMPWATCH_KEEP:
+	    return 0;
+	case TMPWATCH_DEFER:
+	    return 1;
+	}
+    }
+    if (entry->reason == TMPWATCH_REASON_EMPTYDIR)
+	gone = remove_directory(tw, entry->dir, entry->name, entry->stat);
+    else
+	gone = remove_file(tw, entry);
+    if (gone == REMOVE_QUEUED)
+	return gone;
+    if (gone && tw->callbacks.removed != NULL)
+	tw->callbacks.removed(tw->data, entry);
+    return gone;
+}
+
+/* Compare the roots of two rules by identity */
+static int
+cmp_rules(const void *xa, const void *xb)
+{
+    const struct tmpwatch_policy *const *a, *const *b;
+
+    a = xa;
+    b = xb;
+    if ((*a)->root_dev != (*b)->root_dev)
+	return (*a)->root_dev < (*b)->root_dev ? -1 : 1;
+    if ((*a)->root_ino != (*b)->root_ino)
+	return (*a)->root_ino < (*b)->root_ino ? -1 : 1;
+    return 0;
+}
+
+/* Return the rule of TW for directory DEV, INO, or NULL */
+static struct tmpwatch_policy *
+lookup_rule(struct tmpwatch *tw, dev_t dev, ino_t ino)
+{
+    struct tmpwatch_policy key, *keyp, **p;
+
+    if (tw->num_rules == 0)
+	return NULL;
+    if (!tw->rules_sorted) {
+	qsort(tw->rules, tw->num_rules, sizeof(*tw->rules), cmp_rules);
+	tw->rules_sorted = 1;
+    }
+    key.root_dev = dev;
+    key.root_ino = ino;
+    keyp = &key;
+    p = bsearch(&keyp, tw->rules, tw->num_rules, sizeof(*tw->rules),
+		cmp_rules);
+    return p != NULL ? *p : NULL;
+}
+
+/* Return the rule of TW for directory DEV, INO (and mark it visited), or
+   PARENT if there is no rule for it.  Set *DONE if the rule was visited
+   before, so its contents were already cleaned up. */
+static const struct tmpwatch_policy *
+find_policy(struct tmpwatch *tw, dev_t dev, ino_t ino,
+	    const struct tmpwatch_policy *parent, int *done)
+{
+    struct tmpwatch_policy *p;
+
+    *done = 0;
+    if ((p = lookup_rule(tw, dev, ino)) == NULL)
+	return parent;
+    message(tw, TMPWATCH_LOG_DEBUG, "using the rule for %s\n", p->root);
+    *done = p->visited;
+    p->visited = 1;
+    return p;
+}
+
+/* Add directory DEV, INO, to be resumed at entry NAME at POS, to the frontier
+   of TW */
+static void
+frontier_push(struct tmpwatch *tw, dev_t dev, ino_t ino, long pos,
+	      const char *name)
+{
+    struct tmpwatch_position *l;
+
+    if (tw->frontier_len == tw->frontier_allocated) {
+	struct tmpwatch_position *p;
+	size_t allocated;
+
+	allocated = tw->frontier_allocated == 0 ? 16
+	    : 2 * tw->frontier_allocated;
+	p = reallocarray(tw->frontier, allocated, sizeof(*tw->frontier));
+	if (p == NULL) {
+	    message(tw, TMPWATCH_LOG_FATAL, "error allocating memory\n");
+	    return;
+	}
+	tw->frontier = p;
+	tw->frontier_allocated = allocated;
+    }
+    l = &tw->frontier[tw->frontier_len];
+    l->dev = dev;
+    l->ino = ino;
+    l->pos = pos;
+    if ((l->name = strdup(name)) == NULL) {
+	message(tw, TMPWATCH_LOG_FATAL, "error allocating memory\n");
+	return;
+    }
+    tw->frontier_len++;
+}
+
+static void
+frontier_free(struct tmpwatch *tw)
+{
+    size_t i;
+
+    for (i = 0; i < tw->frontier_len; i++)
+	free(tw->frontier[i].name);
+    tw->frontier_len = 0;
+}
+
+/* Stop resuming from the checkpoint; handle everything from now on */
+static void
+end_resume(struct tmpwatch *tw)
+{
+    size_t i;
+
+    for (i = 0; i < tw->num_resume_levels; i++)
+	free(tw->resume_levels[i].name);
+    tw->num_resume_levels = 0;
+    tw->resume_depth = 0;
+}
+
+/* Return a monotonic time in nanoseconds with TMPWATCH_PROFILE, 0 otherwise */
+static uint64_t
+profile_clock(const struct tmpwatch *tw)
+{
+    if ((tw->flags & TMPWATCH_PROFILE) == 0)
+	return 0;
+#if defined (HAVE_CLOCK_GETTIME) && defined (CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+}
+
+/* Count entry NAME of the directory of PROFILE as kept for KEPT */
+static void
+entry_kept(struct tmpwatch_dir_profile *profile, const char *name, int kept)
+{
+    profile->kept[kept]++;
+    PROBE3(entry__kept, profile->dir, name, kept);
+}
+
+/* Report PROFILE of a directory entered at START, of which CHILDREN was spent
+   in subdirectories */
+static void
+profile_done(struct tmpwatch *tw, struct tmpwatch_dir_profile *profile,
+	     uint64_t start, uint64_t children)
+{
+    if ((tw->flags & TMPWATCH_PROFILE) == 0 || tw->callbacks.profile == NULL)
+	return;
+    profile->time = profile_clock(tw) - start - children;
+    tw->callbacks.profile(tw->data, profile);
+}
+
+/* A directory being cleaned up by cleanupDirectory().  Apart from this
+   structure, each level uses the length of its name plus one byte of
+   tmpwatch.path, and while it is open a DIR stream with its buffer. */
+struct level
+{
+    void *dir;			/* NULL while closed by make_room() */
+    size_t path_len;		/* Length of its path in tmpwatch.path */
+    struct stat here;		/* lstat() of the directory when entered */
+    const struct tmpwatch_policy *policy;
+    unsigned depth;		/* Below the root of policy */
+    struct filter_dir fd;
+    long dir_data;		/* For the callbacks */
+    unsigned long left;		/* Entries that were not removed */
+    long pos;			/* telldir() cookie of the current entry */
+    const struct tmpwatch_position *resume; /* Skipping to resume->name */
+    int seeked, resumed;
+    /* The times in HERE must be restored: the directory was read without
+       O_NOATIME, or an entry was removed */
+    int touched;
+    /* The subdirectory at the current entry, being or just cleaned up */
+    int in_child;
+    struct stat child_stat;
+    time_t child_time;		/* Its significant time */
+    unsigned long child_left;	/* Entries left in it; 1 if unknown */
+    int child_other_shard;	/* It is removed by another shard */
+    struct deleter_dir *ddir;	/* Entries queued for tw->deleter, or NULL */
+    /* For TMPWATCH_PROFILE */
+    struct tmpwatch_dir_profile profile;
+    uint64_t start, children, child_start;
+};
+
+/* What scan_level() stopped for */
+#define SCAN_DESCEND	0	/* A subdirectory is to be handled */
+#define SCAN_DONE	1	/* The directory is finished */
+#define SCAN_FAILED	2	/* Reading the directory failed */
+
+/* Make the path of LV the string in tw->path, and return it */
+static const char *
+level_path(struct tmpwatch *tw, struct level *lv)
+{
+    tw->path[lv->path_len] = 0;
+    lv->fd.fulldirname = tw->path;
+    lv->profile.dir = tw->path;
+    return tw->path;
+}
+
+/* Append "/NAME" to the path of LV in tw->path.
+   Return 0 if OK, -1 on memory allocation failure. */
+static int
+append_path(struct tmpwatch *tw, const struct level *lv, const char *name)
+{
+    size_t size;
+
+    size = lv->path_len + 1 + strlen(name) + 1;
+    if (size > tw->path_allocated) {
+	char *p;
+
+	if ((p = realloc(tw->path, 2 * size)) == NULL)
+	    return -1;
+	tw->path = p;
+	tw->path_allocated = 2 * size;
+    }
+    tw->path[lv->path_len] = '/';
+    strcpy(tw->path + lv->path_len + 1, name);
+    return 0;
+}
+
+/* Close the outermost open directory of TW, if needed to open one more
+   directory within tw->max_open_dirs */
+static void
+make_room(struct tmpwatch *tw)
+{
+    size_t i;
+
+    if (tw->open_dirs < tw->max_open_dirs)
+	return;
+    for (i = 0; i < tw->num_levels; i++) {
+	struct level *lv;
+
+	lv = &tw->levels[i];
+	if (lv->dir != NULL) {
+	    message(tw, TMPWATCH_LOG_REALDEBUG, "closing %.*s for now\n",
+		    (int)lv->path_len, tw->path);
+	    (void)tw->fs->closedir(tw->fs_data, lv->dir);
+	    lv->dir = NULL;
+	    tw->open_dirs--;
+	    return;
+	}
+    }
+}
+
+/* The POSIX functions, for struct tmpwatch_fs_ops */
+
+static int
+posix_lstat(void *fs, const char *path, struct stat *sb)
+{
+    (void)fs;
+    return lstat(path, sb);
+}
+
+static int
+posix_chdir(void *fs, const char *path)
+{
+    (void)fs;
+    return chdir(path);
+}
+
+/* Open the current directory for reading, without updating its atime if
+   permitted, and set *TOUCHED if it may be updated. */
+static void *
+posix_opendir(void *fs, int *touched)
+{
+    DIR *dir;
+    int fd, saved_errno;
+
+    (void)fs;
+    fd = -1;
+    if (O_NOATIME != 0)
+	fd = open(".", O_RDONLY | O_DIRECTORY | O_NOCTTY | O_NOATIME);
+    if (fd == -1) {
+	/* O_NOATIME is refused for directories we don't own without
+	   CAP_FOWNER */
+	if ((fd = open(".", O_RDONLY | O_DIRECTORY | O_NOCTTY)) == -1)
+	    return NULL;
+	*touched = 1;
+    }
+    if ((dir = fdopendir(fd)) == NULL) {
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+    }
+    return dir;
+}
+
+static struct dirent *
+posix_readdir(void *fs, void *dir)
+{
+    (void)fs;
+    return readdir(dir);
+}
+
+static long
+posix_telldir(void *fs, void *dir)
+{
+    (void)fs;
+    return telldir(dir);
+}
+
+static void
+posix_seekdir(void *fs, void *dir, long pos)
+{
+    (void)fs;
+    seekdir(dir, pos);
+}
+
+static void
+posix_rewinddir(void *fs, void *dir)
+{
+    (void)fs;
+    rewinddir(dir);
+}
+
+static int
+posix_closedir(void *fs, void *dir)
+{
+    (void)fs;
+    return closedir(dir);
+}
+
+static int
+posix_fchdir(void *fs, void *dir)
+{
+    (void)fs;
+    return fchdir(dirfd((DIR *)dir));
+}
+
+static int
+posix_unlink(void *fs, const char *name)
+{
+    (void)fs;
+    return unlink(name);
+}
+
+static int
+posix_rmdir(void *fs, const char *name)
+{
+    (void)fs;
+    return rmdir(name);
+}
+
+static int
+posix_utimens(void *fs, const struct timespec times[2])
+{
+    (void)fs;
+#ifdef HAVE_UTIMENSAT
+    return utimensat(AT_FDCWD, ".", times, 0);
+#else
+    struct utimbuf utb;
+
+    utb.actime = times[0].tv_sec;
+    utb.modtime = times[1].tv_sec;
+    return utime(".", &utb);
+#endif
+}
+
+/* FS is the struct bind_mounts of the sweep context */
+static int
+posix_is_bind_mount(void *fs, const char *path)
+{
+    return is_bind_mount(fs, path);
+}
+
+static const struct tmpwatch_fs_ops posix_fs_ops = {
+    posix_lstat, posix_chdir, posix_opendir, posix_readdir, posix_telldir,
+    posix_seekdir, posix_rewinddir, posix_closedir, posix_fchdir,
+    posix_unlink, posix_rmdir, posix_utimens, posix_is_bind_mount
+};
+
+/* Open the current directory again for LV, closed by make_room(), at the
+   entry CHILD after lv->pos.
+   Return 0 if OK, -1 on error. */
+static int
+reopen_level(struct tmpwatch *tw, struct level *lv, const char *child)
+{
+    struct dirent *ent;
+
+    make_room(tw);
+    if ((lv->dir = tw->fs->opendir(tw->fs_data, &lv->touched)) == NULL) {
+	message(tw, TMPWATCH_LOG_ERROR,
+		"opendir error on current directory %s: %s\n", tw->path,
+		strerror(errno));
+	return -1;
+    }
+    tw->open_dirs++;
+    tw->fs->seekdir(tw->fs_data, lv->dir, lv->pos);
+    ent = tw->fs->readdir(tw->fs_data, lv->dir);
+    if (ent != NULL && strcmp(ent->d_name, child) == 0)
+	return 0;
+    /* The directory was compacted; look for CHILD by name instead. */
+    tw->fs->rewinddir(tw->fs_data, lv->dir);
+    while ((ent = tw->fs->readdir(tw->fs_data, lv->dir)) != NULL) {
+	if (strcmp(ent->d_name, child) == 0)
+	    return 0;
+    }
+    message(tw, TMPWATCH_LOG_VERBOSE, "%s/%s is gone, cleaning up %s from "
+	    "the start again\n", tw->path, child, tw->path);
+    tw->fs->rewinddir(tw->fs_data, lv->dir);
+    return 0;
+}
+
+/* Return 1 if the current directory of TW is that of LV */
+static int
+in_level_dir(struct tmpwatch *tw, const struct level *lv)
+{
+    struct stat sb;
+
+    return tw->fs->lstat(tw->fs_data, ".", &sb) == 0
+	&& sb.st_dev == lv->here.st_dev
+	&& sb.st_ino == lv->here.st_ino;
+}
+
+/* Change to the directory of the innermost level of TW and make sure it is
+   open.  If it was closed, try "..", and if that is not the same directory
+   any more, walk down by name from the innermost open level, checking the
+   identity of each directory.
+   Return -1 if OK, or the index of the outermost level that can not be
+   entered. */
+static ssize_t
+return_to_top(struct tmpwatch *tw)
+{
+    ssize_t top, i, j;
+
+    top = tw->num_levels - 1;
+    if (tw->levels[top].dir == NULL) {
+	struct level *lv;
+
+	lv = &tw->levels[top];
+	if (in_level_dir(tw, lv)
+	    || (tw->fs->chdir(tw->fs_data, "..") == 0 && in_level_dir(tw, lv)))
+	    return reopen_level(tw, lv, tw->path + lv->path_len + 1) == 0
+		? -1 : top;
+    }
+    for (i = top; i >= 0 && tw->levels[i].dir == NULL; i--)
+	;
+    if (i >= 0 && tw->fs->fchdir(tw->fs_data, tw->levels[i].dir) != 0) {
+	tw->path[tw->levels[i].path_len] = 0;
+	message(tw, TMPWATCH_LOG_ERROR, "can not return to %s: %s\n",
+		tw->path, strerror(errno));
+	return i;
+    }
+    for (j = i + 1; j <= top; j++) {
+	const struct level *lv;
+	const char *name;
+	char c;
+	int res;
+
+	lv = &tw->levels[j];
+	name = j == 0 ? tw->path : tw->path + tw->levels[j - 1].path_len + 1;
+	c = tw->path[lv->path_len];
+	tw->path[lv->path_len] = 0;
+	message(tw, TMPWATCH_LOG_DEBUG, "entering %s again\n", tw->path);
+	res = safe_chdir(tw, tw->path, name, lv->here.st_dev,
+			 lv->here.st_ino);
+	if (res == 2)
+	    message(tw, TMPWATCH_LOG_VERBOSE, "%s is gone\n", tw->path);
+	tw->path[lv->path_len] = c;
+	if (res != 0)
+	    return j;
+    }
+    if (i != top
+	&& reopen_level(tw, &tw->levels[top],
+			tw->path + tw->levels[top].path_len + 1) != 0)
+	return top;
+    return -1;
+}
+
+#ifdef _DIRENT_HAVE_D_TYPE
+#define MAYBE_DIR(ENT) ((ENT)->d_type == DT_DIR || (ENT)->d_type == DT_UNKNOWN)
+#else
+#define MAYBE_DIR(ENT) 1
+#endif
+
+/* Return the shard of TW that the entry DEV, INO belongs to.  This must not
+   depend on anything but the entry, for all processes to agree. */
+static unsigned
+entry_shard(const struct tmpwatch *tw, dev_t dev, ino_t ino)
+{
+    uint64_t h;
+
+    /* The finalizer of SplitMix64 */
+    h = (uint64_t)dev * UINT64_C(0x9e3779b97f4a7c15) ^ (uint64_t)ino;
+    h = (h ^ (h >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    h = (h ^ (h >> 27)) * UINT64_C(0x94d049bb133111eb);
+    h ^= h >> 31;
+    return h % tw->shard_count;
+}
+
+/* Return nonzero if the entry INO of a directory on DEV, DEPTH levels below
+   the root of a rule, belongs to another shard than that of TW: subtrees at
+   the shard depth belong to one shard; above it, so do files, but every
+   shard searches the directories */
+static int
+other_shard(const struct tmpwatch *tw, unsigned depth, dev_t dev, ino_t ino)
+{
+    return depth < tw->shard_depth
+	&& entry_shard(tw, dev, ino) != tw->shard_index;
+}
+
+/* Start cleaning up directory RELDIRNAME, at tw->path, that should be
+   ST_DEV, ST_INO, using POLICY: push a level to TW.
+   Return 1 if the level was pushed, 2 if there is nothing to do, 0 on
+   error.  The current directory is unknown unless 1 is returned. */
+static int
+enter_level(struct tmpwatch *tw, const char *reldirname, dev_t st_dev,
+	    ino_t st_ino, const struct tmpwatch_policy *policy)
+{
+    struct level *lv;
+    struct stat here;
+    const char *fulldirname;
+    uint64_t start;
+    void *dir;
+    unsigned depth;
+    int touched;
+
+    start = profile_clock(tw);
+    fulldirname = tw->path;
+    message(tw, TMPWATCH_LOG_DEBUG, "cleaning up directory %s\n",
+	    fulldirname);
+
+    switch (safe_chdir(tw, fulldirname, reldirname, st_dev, st_ino)) {
+    case 0: /* OK */
+	break;
+
+    case 1: /* Error */
+	return 0;
+
+    case 2: /* ENOENT, silently do nothing */
+	return 2;
+    }
+
+    if (tw->fs->lstat(tw->fs_data, ".", &here) != 0) {
+	message(tw, TMPWATCH_LOG_ERROR,
+		"error stat()ing current directory %s: %s\n", fulldirname,
+		strerror(errno));
+	return 0;
+    }
+
+    /* Don't cross filesystems */
+    if (here.st_dev != st_dev) {
+	message(tw, TMPWATCH_LOG_ERROR,
+		"directory %s device changed right under us!!!\n",
+		fulldirname);
+	message(tw, TMPWATCH_LOG_FATAL,
+		"this indicates a possible intrustion attempt\n");
+	return 2;
+    }
+
+    /* Check '.' and expected inode */
+    if (here.st_ino != st_ino) {
+	message(tw, TMPWATCH_LOG_ERROR,
+		"directory %s inode changed right under us!!!\n", fulldirname);
+	message(tw, TMPWATCH_LOG_FATAL,
+		"this indicates a possible intrusion attempt\n");
+	return 2;
+    }
+
+    if (tw->num_levels == tw->levels_allocated) {
+	struct level *levels;
+	size_t allocated;
+
+	allocated = tw->levels_allocated == 0 ? 16 : 2 * tw->levels_allocated;
+	levels = reallocarray(tw->levels, allocated, sizeof(*tw->levels));
+	if (levels == NULL) {
+	    message(tw, TMPWATCH_LOG_FATAL, "error allocating memory\n");
+	    return 2;
+	}
+	tw->levels = levels;
+	tw->levels_allocated = allocated;
+    }
+
+    /* A rule starts its own division into shards */
+    if (tw->num_levels == 0
+	|| tw->levels[tw->num_levels - 1].policy != policy)
+	depth = 0;
+    else
+	depth = tw->levels[tw->num_levels - 1].depth + 1;
+
+    make_room(tw);
+    touched = 0;
+    if ((dir = tw->fs->opendir(tw->fs_data, &touched)) == NULL) {
+	message(tw, TMPWATCH_LOG_ERROR,
+		"opendir error on current directory %s: %s\n", fulldirname,
+		strerror(errno));
+	return 0;
+    }
+    tw->open_dirs++;
+    PROBE3(dir__enter, fulldirname, here.st_dev, here.st_ino);
+
+    lv = &tw->levels[tw->num_levels];
+    memset(lv, 0, sizeof(*lv));
+    lv->dir = dir;
+    lv->path_len = strlen(fulldirname);
+    lv->here = here;
+    lv->touched = touched;
+    lv->policy = policy;
+    lv->depth = depth;
+    lv->dir_data = -1;
+    lv->start = start;
+    lv->profile.depth = tw->num_levels;
+    tw->num_levels++;
+    add_progress(tw, 1, 0, 0, 0);
+
+    if (tw->resume_depth < tw->num_resume_levels) {
+	lv->resume = &tw->resume_levels[tw->resume_depth];
+	if (lv->resume->dev == here.st_dev && lv->resume->ino == here.st_ino) {
+	    /* The entries before the checkpoint were not examined */
+	    lv->left++;
+	    tw->fs->seekdir(tw->fs_data, dir, lv->resume->pos);
+	    lv->seeked = 1;
+	} else {
+	    message(tw, TMPWATCH_LOG_VERBOSE, "%s changed since the "
+		    "checkpoint, cleaning it up from the start\n",
+		    fulldirname);
+	    lv->resume = NULL;
+	    end_resume(tw);
+	}
+    }
+
+    filter_dir_init(&lv->fd, tw, policy, fulldirname, st_dev);
+#ifdef FUSER
+    lv->fd.batch_fuser = 1;
+#endif
+    return 1;
+}
+
+/* Return 1 if a socket may be bound to the socket file SB, 0 if none is */
+static int
+socket_bound(struct tmpwatch *tw, const struct stat *sb)
+{
+    if (tw->unix_sockets.state == 0
+	&& unix_sockets_read(&tw->unix_sockets) != 0)
+	message(tw, TMPWATCH_LOG_VERBOSE, "cannot list bound sockets, "
+		"keeping sockets created since boot: %s\n", strerror(errno));
+    if (tw->unix_sockets.state != 1)
+	return 1;
+    return unix_socket_bound(&tw->unix_sockets, sb->st_dev, sb->st_ino);
+}
+
+/* Decide whether entry NAME of the current directory, described by SB, is
+   to be removed under POLICY; FD is the state of run_filter() for the
+   directory.  A directory passing is to be cleaned up (and removed if it is
+   older than POLICY's kill time and empty afterwards).  Set *TIME to the
+   significant time of NAME, and *THRESHOLD to the time it must be older
+   than (0 for a directory).
+   Return TMPWATCH_KEPT_MAX if NAME passes, the TMPWATCH_KEPT_* reason for
+   keeping it otherwise. */
+static int
+classify_entry(const struct tmpwatch_policy *policy, struct filter_dir *fd,
+	       const char *name, const struct stat *sb, time_t *time,
+	       time_t *threshold)
+{
+    struct tmpwatch *tw;
+    int rejected;
+
+    tw = fd->tw;
+    *threshold = 0;
+    rejected = run_filter(policy->filters, policy, fd, name, sb);
+    if (rejected != FILTER_END)
+	return filter_kept[rejected];
+
+    *time = entry_time(sb, S_ISDIR(sb->st_mode) ? policy->dir_fields
+		       : policy->file_fields);
+    if (tw->log_level <= TMPWATCH_LOG_REALDEBUG)
+	message(tw, TMPWATCH_LOG_REALDEBUG, "taking as significant time: %s",
+		ctime(time));
+    if (S_ISDIR(sb->st_mode))
+	return TMPWATCH_KEPT_MAX;
+
+    if (S_ISSOCK(sb->st_mode)) {
+	*threshold = policy->socket_kill_time;
+	if ((policy->flags & TMPWATCH_UNBOUND_SOCKETS) != 0
+	    && *time < policy->kill_time
+	    && (*threshold == 0 || *time >= *threshold)
+	    && !socket_bound(tw, sb))
+	    *threshold = policy->kill_time;
+	if (*threshold == 0)
+	    return TMPWATCH_KEPT_RECENT;
+    } else /* Not a socket */
+	*threshold = policy->kill_time;
+    if (*time >= *threshold)
+	return TMPWATCH_KEPT_RECENT;
+
+    rejected = run_filter(policy->file_filters, policy, fd, name, sb);
+    if (rejected != FILTER_END)
+	return filter_kept[rejected];
+    return TMPWATCH_KEPT_MAX;
+}
+
+/* Prepare ENTRY for entries of LV */
+static void
+init_entry(struct tmpwatch_entry *entry, struct level *lv,
+	   const char *fulldirname)
+{
+    entry->dir = fulldirname;
+    entry->dir_stat = &lv->here;
+    entry->flags = lv->policy->flags;
+    entry->dir_data = &lv->dir_data;
+}
+
+/* Remove the files of JOB from the current directory, the innermost level
+   of TW, if SHREDDED; otherwise keep them */
+static void
+remove_shredded(struct tmpwatch *tw, struct shred_job *job, int shredded)
+{
+    struct level *lv;
+    struct tmpwatch_entry entry;
+    const char *fulldirname;
+    unsigned long removals;
+    size_t i;
+
+    lv = &tw->levels[tw->num_levels - 1];
+    fulldirname = level_path(tw, lv);
+    init_entry(&entry, lv, fulldirname);
+    removals = tw->removals;
+    for (i = 0; i < job->len; i++) {
+	struct shred_wait *w;
+
+	w = &job->files[i];
+	if (shredded && unlink_file(tw, fulldirname, w->arg + 2, &w->sb)) {
+	    /* Left uncounted by expire_file() */
+	    lv->left--;
+	    lv->profile.removed_bytes += w->sb.st_size;
+	    add_progress(tw, 0, 0, 1, w->sb.st_size);
+	    if (tw->callbacks.removed != NULL) {
+		entry.name = w->arg + 2;
+		entry.stat = &w->sb;
+		entry.time = w->time;
+		entry.threshold = w->threshold;
+		entry.reason = w->reason;
+		tw->callbacks.removed(tw->data, &entry);
+	    }
+	} else
+	    entry_kept(&lv->profile, w->arg + 2, TMPWATCH_KEPT_NOT_REMOVED);
+	free(w->arg);
+    }
+    if (tw->removals != removals)
+	lv->touched = 1;
+    free(job->files);
+}
+
+/* Wait for the oldest of the shred_jobs of TW, and remove its files if it
+   succeeded */
+static void
+finish_shred_job(struct tmpwatch *tw)
+{
+    struct shred_job *job;
+    int ok;
+
+    job = &tw->shred_jobs[0];
+    ok = wait_shred(job->pid);
+    if (!ok)
+	message(tw, TMPWATCH_LOG_ERROR, "shred failed for %zu files in %s, "
+		"not removing them\n", job->len,
+		level_path(tw, &tw->levels[tw->num_levels - 1]));
+    remove_shredded(tw, job, ok);
+    tw->num_shred_jobs--;
+    memmove(tw->shred_jobs, tw->shred_jobs + 1,
+	    tw->num_shred_jobs * sizeof(*tw->shred_jobs));
+}
+
+/* Start shred on tw->shred_batch, after waiting for a job to finish if
+   SHRED_JOBS are running */
+static void
+start_shred_job(struct tmpwatch *tw)
+{
+    struct shred_job *job;
+    char **args;
+    size_t i;
+
+    if (tw->num_shred_jobs == SHRED_JOBS)
+	finish_shred_job(tw);
+    job = &tw->shred_jobs[tw->num_shred_jobs];
+    *job = tw->shred_batch;
+    tw->shred_batch.files = NULL;
+    tw->shred_batch.len = 0;
+    tw->shred_batch.bytes = 0;
+    job->pid = -1;
+    if ((args = malloc(job->len * sizeof(*args))) != NULL) {
+	for (i = 0; i < job->len; i++)
+	    args[i] = job->files[i].arg;
+	job->pid = spawn_shred(tw, args, job->len);
+	free(args);
+    }
+    if (job->pid == -1) {
+	/* something went wrong; remove them as before */
+	message(tw, TMPWATCH_LOG_ERROR, "cannot run %s: %s.  No shredding "
+		"will occur for files.\n", tw->shred_path, strerror(errno));
+	remove_shredded(tw, job, 1);
+    } else
+	tw->num_shred_jobs++;
+}
+
+/* Shred the files of the current directory waiting for it, and remove
+   them */
+static void
+finish_shredding(struct tmpwatch *tw)
+{
+    if (tw->shred_batch.len != 0)
+	start_shred_job(tw);
+    while (tw->num_shred_jobs != 0)
+	finish_shred_job(tw);
+}
+
+/* Add the file of ENTRY, in the current directory, to the files to be
+   shredded by tw->shred_batch, starting it if it is full.
+   Return 0 if OK, -1 on memory allocation failure. */
+static int
+queue_shred(struct tmpwatch *tw, const struct tmpwatch_entry *entry)
+{
+    struct shred_wait *w;
+    size_t size;
+
+    /* "./NAME" and its pointer in argv */
+    size = strlen(entry->name) + 3 + sizeof(char *);
+    if (tw->shred_batch.len != 0
+	&& tw->shred_batch.bytes + size > args_size_max())
+	start_shred_job(tw);
+    if (tw->shred_batch.files == NULL) {
+	tw->shred_batch.files = malloc(SHRED_BATCH
+				       * sizeof(*tw->shred_batch.files));
+	if (tw->shred_batch.files == NULL)
+	    return -1;
+    }
+    w = &tw->shred_batch.files[tw->shred_batch.len];
+    if (asprintf(&w->arg, "./%s", entry->name) == -1)
+	return -1;
+    w->sb = *entry->stat;
+    w->time = entry->time;
+    w->threshold = entry->threshold;
+    w->reason = entry->reason;
+    tw->shred_batch.len++;
+    tw->shred_batch.bytes += size;
+    if (tw->shred_batch.len == SHRED_BATCH)
+	start_shred_job(tw);
+    return 0;
+}
+
+/* Remove NAME, an expired file of LV described by SB, with significant
+   time TIME older than THRESHOLD; ENTRY was prepared for LV */
+static void
+expire_file(struct tmpwatch *tw, struct level *lv,
+	    struct tmpwatch_entry *entry, const char *name,
+	    const struct stat *sb, time_t time, time_t threshold)
+{
+    unsigned long removals;
+    uint64_t t;
+    int gone;
+
+    entry->name = name;
+    entry->stat = sb;
+    entry->time = time;
+    entry->threshold = threshold;
+    entry->reason = S_ISSOCK(sb->st_mode) ? TMPWATCH_REASON_SOCKET
+	: TMPWATCH_REASON_EXPIRED;
+    lv->profile.eligible_bytes += sb->st_size;
+    t = profile_clock(tw);
+    removals = tw->removals;
+    gone = remove_entry(tw, entry);
+    lv->profile.unlink_time += profile_clock(tw) - t;
+    if (tw->removals != removals)
+	lv->touched = 1;
+    if (gone == REMOVE_QUEUED)
+	return;
+    if (gone) {
+	lv->profile.removed_bytes += sb->st_size;
+	add_progress(tw, 0, 0, 1, sb->st_size);
+    } else
+	entry_kept(&lv->profile, name, TMPWATCH_KEPT_NOT_REMOVED);
+    lv->left -= gone;
+}
+
+/* Files checked by one run of fuser at most */
+#define FUSER_BATCH 256
+
+#ifdef FUSER
+/* Check the files of LV, the current directory, waiting for fuser, and
+   remove those that are not in use; after a failure, keep them all */
+static void
+finish_fuser_batch(struct tmpwatch *tw, struct level *lv)
+{
+    struct tmpwatch_entry entry;
+    const char *fulldirname;
+    unsigned char *in_use;
+    char **argv, **args;
+    size_t i, n;
+
+    n = tw->fuser_waiting_len;
+    if (n == 0)
+	return;
+    fulldirname = level_path(tw, lv);
+    argv = malloc((FUSER_OPTIONS + 2 * n + 1) * sizeof(*argv));
+    in_use = malloc(n);
+    if (argv == NULL || in_use == NULL)
+	message(tw, TMPWATCH_LOG_FATAL, "error allocating memory\n");
+    if (!tw->failed) {
+	args = argv + FUSER_OPTIONS + n + 1;
+	for (i = 0; i < n; i++)
+	    args[i] = tw->fuser_waiting[i].arg;
+	check_fuser_batch(argv, args, n, in_use);
+    }
+    init_entry(&entry, lv, fulldirname);
+    for (i = 0; i < n; i++) {
+	struct fuser_wait *w;
+
+	w = &tw->fuser_waiting[i];
+	if (tw->failed)
+	    entry_kept(&lv->profile, w->arg + 2, TMPWATCH_KEPT_ERROR);
+	else if (in_use[i]) {
+	    message(tw, TMPWATCH_LOG_VERBOSE,
+		    "file is already in use or open: %s/%s\n", fulldirname,
+		    w->arg + 2);
+	    entry_kept(&lv->profile, w->arg + 2, TMPWATCH_KEPT_IN_USE);
+	} else
+	    expire_file(tw, lv, &entry, w->arg + 2, &w->sb, w->time,
+			w->threshold);
+	free(w->arg);
+    }
+    free(in_use);
+    free(argv);
+    tw->fuser_waiting_len = 0;
+    tw->fuser_bytes = 0;
+}
+#else
+#define finish_fuser_batch(TW, LV) ((void)(LV))
+#endif
+
+/* Add NAME, an expired file of LV described by SB, with significant time
+   TIME older than THRESHOLD, to the files waiting for fuser; a full batch
+   is checked first.
+   Return 0 if OK, -1 on memory allocation failure. */
+static int
+wait_for_fuser(struct tmpwatch *tw, struct level *lv, const char *name,
+	       const struct stat *sb, time_t time, time_t threshold)
+{
+    struct fuser_wait *w;
+    size_t size;
+
+    /* "./NAME" and its pointer in argv */
+    size = strlen(name) + 3 + sizeof(char *);
+    if (tw->fuser_waiting_len == FUSER_BATCH
+	|| (tw->fuser_waiting_len != 0
+	    && tw->fuser_bytes + size > args_size_max()))
+	finish_fuser_batch(tw, lv);
+    if (tw->fuser_waiting_len == tw->fuser_waiting_allocated) {
+	size_t allocated;
+
+	allocated = tw->fuser_waiting_allocated == 0 ? 16
+	    : 2 * tw->fuser_waiting_allocated;
+	w = reallocarray(tw->fuser_waiting, allocated,
+			 sizeof(*tw->fuser_waiting));
+	if (w == NULL)
+	    return -1;
+	tw->fuser_waiting = w;
+	tw->fuser_waiting_allocated = allocated;
+    }
+    w = &tw->fuser_waiting[tw->fuser_waiting_len];
+    if (asprintf(&w->arg, "./%s", name) == -1)
+	return -1;
+    w->sb = *sb;
+    w->time = time;
+    w->threshold = threshold;
+    tw->fuser_waiting_len++;
+    tw->fuser_bytes += size;
+    return 0;
+}
+
+/* Handle entries of LV, the innermost level of TW, until reaching a
+   subdirectory or the end.
+   Return SCAN_*. */
+static int
+scan_entries(struct tmpwatch *tw, struct level *lv)
+{
+    const struct tmpwatch_policy *policy, *child_policy;
+    const char *fulldirname;
+    struct dirent *ent;
+    struct stat sb;
+    struct tmpwatch_entry entry;
+    time_t significant_time, threshold;
+    uint64_t t;
+    int res, kept, done, shard;
+
+    policy = lv->policy;
+    fulldirname = level_path(tw, lv);
+    set_progress_path(tw, fulldirname);
+    init_entry(&entry, lv, fulldirname);
+    entry.stat = &sb;
+    for (;;) {
+	/* Everything after the entry we resumed at is cleaned up normally */
+	if (lv->resumed) {
+	    end_resume(tw);
+	    lv->resumed = 0;
+	}
+
+	lv->pos = tw->fs->telldir(tw->fs_data, lv->dir);
+	t = profile_clock(tw);
+	errno = 0;
+	ent = tw->fs->readdir(tw->fs_data, lv->dir);
+	lv->profile.readdir_time += profile_clock(tw) - t;
+	if (errno != 0) {
+	    message(tw, TMPWATCH_LOG_ERROR,
+		    "error reading directory entry: %s\n", strerror(errno));
+	    return SCAN_FAILED;
+	}
+	if (ent == NULL) {
+	    if (lv->resume != NULL) {
+		message(tw, TMPWATCH_LOG_VERBOSE,
+			"%s/%s is gone, not resuming below it\n",
+			fulldirname, lv->resume->name);
+		lv->resume = NULL;
+		end_resume(tw);
+	    }
+	    return SCAN_DONE;
+	}
+
+	/* don't go crazy with the current directory or its parent */
+	if (ent->d_name[0] == '.'
+	    && (ent->d_name[1] == 0
+		|| (ent->d_name[1] == '.' && ent->d_name[2] == 0)))
+	    continue;
+	lv->profile.entries++;
+	add_progress(tw, 0, 1, 0, 0);
+
+	if (lv->resume != NULL) {
+	    if (strcmp(ent->d_name, lv->resume->name) != 0) {
+		/* The directory was compacted since the checkpoint; look for
+		   the entry by name instead. */
+		if (lv->seeked) {
+		    tw->fs->rewinddir(tw->fs_data, lv->dir);
+		    lv->seeked = 0;
+		}
+		continue;
+	    }
+	    message(tw, TMPWATCH_LOG_DEBUG, "resuming at %s/%s\n",
+		    fulldirname, ent->d_name);
+	    lv->resume = NULL;
+	    tw->resume_depth++;
+	    lv->resumed = 1;
+	}
+
+	if (tw->failed)
+	    return SCAN_DONE;
+	if (tw->stop_requested) {
+	    tw->interrupted = 1;
+	    frontier_push(tw, lv->here.st_dev, lv->here.st_ino, lv->pos,
+			  ent->d_name);
+	    return SCAN_DONE;
+	}
+
+	shard = other_shard(tw, lv->depth, lv->here.st_dev, ent->d_ino);
+	if (shard && (lv->depth + 1 == tw->shard_depth || !MAYBE_DIR(ent))) {
+	    lv->left++;
+	    entry_kept(&lv->profile, ent->d_name, TMPWATCH_KEPT_SHARD);
+	    continue;
+	}
+
+	t = profile_clock(tw);
+	res = tw->fs->lstat(tw->fs_data, ent->d_name, &sb);
+	lv->profile.stat_time += profile_clock(tw) - t;
+	lv->profile.stats++;
+	if (res != 0) {
+	    if (errno != ENOENT) {
+		lv->left++;
+		entry_kept(&lv->profile, ent->d_name, TMPWATCH_KEPT_ERROR);
+	    }
+	    /* FUSE mounts by different users return EACCES by default. */
+	    if (errno != ENOENT && errno != EACCES)
+		message(tw, TMPWATCH_LOG_ERROR, "failed to lstat %s/%s: %s\n",
+			fulldirname, ent->d_name, strerror(errno));
+	    continue;
+	}
+
+	/* Assume ENT stays until it is actually removed */
+	lv->left++;
+	/* The quarantine is emptied by tmpwatch_purge_quarantine() */
+	if (tw->trash_fd != -1 && sb.st_ino == tw->trash_ino
+	    && sb.st_dev == tw->trash_dev) {
+	    entry_kept(&lv->profile, ent->d_name, TMPWATCH_KEPT_EXCLUDED);
+	    continue;
+	}
+	if (shard && !S_ISDIR(sb.st_mode)) {
+	    entry_kept(&lv->profile, ent->d_name, TMPWATCH_KEPT_SHARD);
+	    continue;
+	}
+
+	message(tw, TMPWATCH_LOG_REALDEBUG, "found directory entry %s\n",
+		ent->d_name);
+
+	kept = classify_entry(policy, &lv->fd, ent->d_name, &sb,
+			      &significant_time, &threshold);
+	if (kept != TMPWATCH_KEPT_MAX) {
+	    entry_kept(&lv->profile, ent->d_name, kept);
+	    continue;
+	}
+
+	if (S_ISDIR(sb.st_mode)) {
+	    /* Before leaving the directory */
+	    finish_fuser_batch(tw, lv);
+	    finish_shredding(tw);
+	    if (append_path(tw, lv, ent->d_name) != 0) {
+		message(tw, TMPWATCH_LOG_FATAL, "error allocating memory\n");
+		return SCAN_DONE;
+	    }
+	    lv->in_child = 1;
+	    lv->child_stat = sb;
+	    lv->child_time = significant_time;
+	    lv->child_left = 1; /* unknown unless cleaned up */
+	    lv->child_other_shard = shard;
+	    lv->child_start = profile_clock(tw);
+	    if (tw->fs->is_bind_mount(tw->fs_data, tw->path))
+		return SCAN_DESCEND;
+	    child_policy = find_policy(tw, lv->here.st_dev, sb.st_ino, policy,
+				       &done);
+	    if (done) {
+		message(tw, TMPWATCH_LOG_DEBUG, "%s was already cleaned up\n",
+			tw->path);
+		return SCAN_DESCEND;
+	    }
+	    res = enter_level(tw, ent->d_name, lv->here.st_dev, sb.st_ino,
+			      child_policy);
+	    if (res == 0)
+		message(tw, TMPWATCH_LOG_ERROR, "cleanup failed in %s: %s\n",
+			tw->path, strerror(errno));
+	    return SCAN_DESCEND;
+	} else if (lv->fd.fuser_deferred) {
+	    /* Checked with the other such files of the directory */
+	    lv->fd.fuser_deferred = 0;
+	    if (wait_for_fuser(tw, lv, ent->d_name, &sb, significant_time,
+			       threshold) != 0) {
+		message(tw, TMPWATCH_LOG_FATAL, "error allocating memory\n");
+		return SCAN_DONE;
+	    }
+	} else
+	    expire_file(tw, lv, &entry, ent->d_name, &sb, significant_time,
+			threshold);
+    }
+}
+
+/* Handle entries of LV, the innermost level of TW, until reaching a
+   subdirectory or the end.
+   Return SCAN_*. */
+static int
+scan_level(struct tmpwatch *tw, struct level *lv)
+{
+    int res;
+
+    res = scan_entries(tw, lv);
+    finish_fuser_batch(tw, lv);
+    finish_shredding(tw);
+    return res;
+}
+
+/* Finish the subdirectory at the current entry of LV, the innermost level of
+   TW, after cleaning it up: remove it if it is old and empty.  Its name
+   follows the path of LV in tw->path.
+   Return 1 if LV must not be continued, 0 otherwise. */
+static int
+subdir_done(struct tmpwatch *tw, struct level *lv)
+{
+    const struct tmpwatch_policy *policy;
+    const char *fulldirname, *name;
+    struct tmpwatch_entry entry;
+
+    policy = lv->policy;
+    fulldirname = level_path(tw, lv);
+    name = fulldirname + lv->path_len + 1;
+
+    /* Revisit the subdirectory when resuming: it was not finished */
+    if (tw->interrupted) {
+	frontier_push(tw, lv->here.st_dev, lv->here.st_ino, lv->pos, name);
+	return 1;
+    }
+    if (tw->failed)
+	return 1;
+
+    if (lv->child_other_shard) {
+	entry_kept(&lv->profile, name, TMPWATCH_KEPT_SHARD);
+	return 0;
+    }
+
+    if (lv->child_time >= policy->kill_time) {
+	entry_kept(&lv->profile, name, TMPWATCH_KEPT_RECENT);
+	return 0;
+    }
+
+    /* Don't bother with rmdir() if something was left inside */
+    if (lv->child_left != 0) {
+	message(tw, TMPWATCH_LOG_DEBUG, "directory %s/%s is not empty\n",
+		fulldirname, name);
+	entry_kept(&lv->profile, name, TMPWATCH_KEPT_NOT_EMPTY);
+	return 0;
+    }
+
+    if ((tw->flags & TMPWATCH_FUSER) != 0
+	&& file_in_use(name, &lv->child_stat)) {
+	message(tw, TMPWATCH_LOG_VERBOSE,
+		"file is already in use or open: %s\n", name);
+	entry_kept(&lv->profile, name, TMPWATCH_KEPT_IN_USE);
+	return 0;
+    }
+
+    /* we should try to remove the directory after cleaning up its
+       contents, as it should contain no files.  Skip if we have
+       specified the "no directories" flag. */
+    if ((policy->flags & TMPWATCH_NODIRS) == 0) {
+	unsigned long removals;
+	uint64_t t;
+	int gone;
+
+	init_entry(&entry, lv, fulldirname);
+	entry.stat = &lv->child_stat;
+	entry.name = name;
+	entry.time = lv->child_time;
+	entry.threshold = policy->kill_time;
+	entry.reason = TMPWATCH_REASON_EMPTYDIR;
+	t = profile_clock(tw);
+	removals = tw->removals;
+	gone = remove_entry(tw, &entry);
+	lv->profile.rmdir_time += profile_clock(tw) - t;
+	if (tw->removals != removals)
+	    lv->touched = 1;
+	if (gone)
+	    add_progress(tw, 0, 0, 1, 0);
+	else
+	    entry_kept(&lv->profile, name, TMPWATCH_KEPT_NOT_REMOVED);
+	lv->left -= gone;
+    } else
+	entry_kept(&lv->profile, name, TMPWATCH_KEPT_NODIRS);
+    return 0;
+}
+
+/* Report the entries in the list F, that tw->deleter did not remove, and
+   free them */
+static void
+report_failures(struct tmpwatch *tw, struct deleter_failure *f)
+{
+    struct deleter_failure *next;
+
+    for (; f != NULL; f = next) {
+	next = f->next;
+	if (f->error == 0)
+	    message(tw, TMPWATCH_LOG_VERBOSE, "%s/%s was replaced before it "
+		    "could be removed\n", f->path, f->name);
+	else
+	    message(tw, TMPWATCH_LOG_ERROR, "failed to %s %s/%s: %s\n",
+		    f->is_dir ? "rmdir" : "unlink", f->path, f->name,
+		    strerror(f->error));
+	free(f);
+    }
+}
+
+/* Queue NAME, the inode of SB, in the current directory FULLDIRNAME, that of
+   the innermost level of TW, for removal by tw->deleter.
+   Return 0 if OK, -1 if NAME must be removed at once. */
+static int
+queue_removal(struct tmpwatch *tw, const char *fulldirname, const char *name,
+	      const struct stat *sb)
+{
+    struct level *lv;
+
+    if (tw->num_levels == 0)
+	return -1;
+    lv = &tw->levels[tw->num_levels - 1];
+    if (lv->ddir == NULL) {
+	/* lv->dir is open while entries of the directory are examined */
+	lv->ddir = deleter_dir_new(dirfd((DIR *)lv->dir), fulldirname,
+				   &lv->here);
+	if (lv->ddir == NULL)
+	    return -1;
+    }
+    if (deleter_submit(tw->deleter, lv->ddir, name, sb) != 0)
+	return -1;
+    report_failures(tw, deleter_failures(tw->deleter));
+    return 0;
+}
+
+/* Set the atime and mtime of the current directory of TW to those in SB.
+   Return 0 if OK, -1 on error. */
+static int
+restore_times(struct tmpwatch *tw, const struct stat *sb)
+{
+    struct timespec times[2];
+
+    times[0] = sb->st_atim;
+    times[1] = sb->st_mtim;
+    return tw->fs->utimens(tw->fs_data, times);
+}
+
+/* Finish the innermost level of TW, the current directory, and pop it.
+   OK is 0 if it could not be read completely.
+   Return the number of entries left in it, 1 if unknown. */
+static unsigned long
+finish_level(struct tmpwatch *tw, int ok)
+{
+    struct level *lv;
+    const char *fulldirname;
+    int saved_errno;
+
+    saved_errno = errno;
+    lv = &tw->levels[tw->num_levels - 1];
+    fulldirname = level_path(tw, lv);
+    profile_done(tw, &lv->profile, lv->start, lv->children);
+    PROBE2(dir__exit, fulldirname, lv->left);
+    filter_dir_free(&lv->fd);
+    tw->num_levels--;
+
+    if (lv->dir != NULL) {
+	tw->open_dirs--;
+	if (tw->fs->closedir(tw->fs_data, lv->dir) == -1) {
+	    message(tw, TMPWATCH_LOG_ERROR, "closedir of %s failed: %s\n",
+		    fulldirname, strerror(errno));
+	    saved_errno = errno;
+	    ok = 0;
+	}
+    }
+    if (!ok) {
+	message(tw, TMPWATCH_LOG_ERROR, "cleanup failed in %s: %s\n",
+		fulldirname, strerror(saved_errno));
+	if (lv->ddir != NULL)
+	    deleter_dir_release(tw->deleter, lv->ddir, 0);
+	return 1;
+    }
+
+    /* restore access time on this directory to its original time; an
+       untouched directory is left alone, saving an inode update */
+    if (lv->ddir != NULL)
+	/* After the queued entries are removed */
+	deleter_dir_release(tw->deleter, lv->ddir, lv->touched);
+    else if (lv->touched && restore_times(tw, &lv->here) == -1)
+	message(tw, TMPWATCH_LOG_DEBUG, "unable to reset atime/mtime for %s\n",
+		fulldirname);
+
+    return lv->left;
+}
+
+/* Give up on levels FIRST and inside of TW, whose directories can not be
+   entered any more */
+static void
+abandon_levels(struct tmpwatch *tw, size_t first)
+{
+    while (tw->num_levels > first) {
+	struct level *lv;
+
+	lv = &tw->levels[tw->num_levels - 1];
+	level_path(tw, lv);
+	profile_done(tw, &lv->profile, lv->start, lv->children);
+	PROBE2(dir__exit, tw->path, lv->left);
+	filter_dir_free(&lv->fd);
+	if (lv->ddir != NULL)
+	    deleter_dir_release(tw->deleter, lv->ddir, 0);
+	if (lv->dir != NULL) {
+	    (void)tw->fs->closedir(tw->fs_data, lv->dir);
+	    tw->open_dirs--;
+	}
+	tw->num_levels--;
+    }
+    /* The name of the first abandoned level follows its parent's path */
+    tw->path[tw->levels[first].path_len] = 0;
+}
+
+/* Clean up the tree at ROOT, an absolute path that should be ST_DEV,
+   ST_INO, using POLICY.  Entries are checked against the policy of their
+   directory: POLICY, or the rule for a subdirectory if TW has one.
+   Directories are walked with an explicit stack, keeping at most
+   tw->max_open_dirs of them open. */
+static void
+cleanupDirectory(struct tmpwatch *tw, const char *root, dev_t st_dev,
+		 ino_t st_ino, const struct tmpwatch_policy *policy)
+{
+    int res;
+
+    if (strlen(root) + 1 > tw->path_allocated) {
+	char *p;
+
+	if ((p = realloc(tw->path, strlen(root) + 1)) == NULL) {
+	    message(tw, TMPWATCH_LOG_FATAL, "error allocating memory\n");
+	    return;
+	}
+	tw->path = p;
+	tw->path_allocated = strlen(root) + 1;
+    }
+    strcpy(tw->path, root);
+    res = enter_level(tw, root, st_dev, st_ino, policy);
+    if (res == 0)
+	message(tw, TMPWATCH_LOG_ERROR, "cleanup failed in %s: %s\n", root,
+		strerror(errno));
+    if (res != 1)
+	return;
+
+    while (tw->num_levels != 0) {
+	struct level *lv;
+	unsigned long left;
+	ssize_t failed;
+
+	lv = &tw->levels[tw->num_levels - 1];
+	if (lv->in_child) {
+	    /* Back from the subdirectory, cleaned up or not */
+	    failed = return_to_top(tw);
+	    if (failed != -1) {
+		abandon_levels(tw, failed);
+		if (tw->num_levels == 0)
+		    return;
+		tw->levels[tw->num_levels - 1].child_left = 1;
+		continue;
+	    }
+	    lv->children += profile_clock(tw) - lv->child_start;
+	    lv->in_child = 0;
+	    if (subdir_done(tw, lv) != 0) {
+		res = SCAN_DONE;
+		goto finish;
+	    }
+	}
+	res = scan_level(tw, lv);
+	if (res == SCAN_DESCEND)
+	    continue;
+
+    finish:
+	left = finish_level(tw, res != SCAN_FAILED);
+	if (tw->num_levels != 0)
+	    tw->levels[tw->num_levels - 1].child_left = left;
+    }
+}
+
+/* Files of a directory examined by a probe of tmpwatch_estimate() */
+#define ESTIMATE_SAMPLE 32
+
+/* A directory read by estimate_probe() */
+struct estimate_dir
+{
+    char **dirs;		/* Names of all subdirectories */
+    size_t num_dirs, dirs_allocated;
+    char *sample[ESTIMATE_SAMPLE]; /* Names of some other entries */
+    size_t num_sample;
+    unsigned long num_files;	/* Entries other than subdirectories */
+};
+
+/* Free the names in ED */
+static void
+estimate_dir_clear(struct estimate_dir *ed)
+{
+    size_t i;
+
+    for (i = 0; i < ed->num_dirs; i++)
+	free(ed->dirs[i]);
+    ed->num_dirs = 0;
+    for (i = 0; i < ed->num_sample; i++)
+	free(ed->sample[i]);
+    ed->num_sample = 0;
+    ed->num_files = 0;
+}
+
+/* Open directory NAME in directory DIR_FD, if it is still ST_DEV, ST_INO,
+   without updating its atime if permitted.
+   Return a descriptor, or -1. */
+static int
+open_subdir(int dir_fd, const char *name, dev_t st_dev, ino_t st_ino)
+{
+    struct stat sb;
+    int fd, flags;
+
+    flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_NOCTTY;
+    fd = -1;
+    if (O_NOATIME != 0)
+	fd = openat(dir_fd, name, flags | O_NOATIME);
+    if (fd == -1 && (fd = openat(dir_fd, name, flags)) == -1)
+	return -1;
+    if (fstat(fd, &sb) != 0 || sb.st_dev != st_dev || sb.st_ino != st_ino) {
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+/* Read DIR into ED: all subdirectories, and a uniform random sample of the
+   other entries using random state XSUBI.  Add the number of entries read
+   and lstat() calls to *EXAMINED.
+   Return 0 if OK, -1 on memory allocation failure. */
+static int
+read_estimate_dir(DIR *dir, struct estimate_dir *ed, unsigned short xsubi[3],
+		  unsigned long *examined)
+{
+    struct dirent *ent;
+    char **slot;
+    size_t i;
+
+    while ((ent = readdir(dir)) != NULL) {
+	int is_dir;
+
+	if (ent->d_name[0] == '.'
+	    && (ent->d_name[1] == 0
+		|| (ent->d_name[1] == '.' && ent->d_name[2] == 0)))
+	    continue;
+	(*examined)++;
+#ifdef _DIRENT_HAVE_D_TYPE
+	if (ent->d_type != DT_UNKNOWN)
+	    is_dir = ent->d_type == DT_DIR;
+	else
+#endif
+	{
+	    struct stat sb;
+
+	    (*examined)++;
+	    is_dir = lstat(ent->d_name, &sb) == 0 && S_ISDIR(sb.st_mode);
+	}
+
+	if (is_dir) {
+	    if (ed->num_dirs == ed->dirs_allocated) {
+		size_t allocated;
+
+		allocated = ed->dirs_allocated == 0 ? 64
+		    : 2 * ed->dirs_allocated;
+		slot = reallocarray(ed->dirs, allocated, sizeof(*ed->dirs));
+		if (slot == NULL)
+		    return -1;
+		ed->dirs = slot;
+		ed->dirs_allocated = allocated;
+	    }
+	    slot = &ed->dirs[ed->num_dirs];
+	} else {
+	    ed->num_files++;
+	    if (ed->num_sample < ESTIMATE_SAMPLE)
+		i = ed->num_sample++;
+	    else {
+		/* Keep each entry in the sample with equal probability */
+		i = nrand48(xsubi) % ed->num_files;
+		if (i >= ESTIMATE_SAMPLE)
+		    continue;
+		free(ed->sample[i]);
+	    }
+	    slot = &ed->sample[i];
+	}
+	if ((*slot = strdup(ent->d_name)) == NULL)
+	    return -1;
+	if (is_dir)
+	    ed->num_dirs++;
+    }
+    return 0;
+}
+
+/* Walk down one random path of the tree in ROOT_FD, at ROOT, which is
+   ROOT_DEV, ROOT_INO, using POLICY and the rules of TW, with random state
+   XSUBI and ED as scratch space.  Set *FILES and *BYTES to an unbiased
+   estimate of the number and size of files that a sweep would remove: those
+   in each directory on the path, weighted by the inverse of the probability
+   of choosing that directory (D. E. Knuth, "Estimating the efficiency of
+   backtrack programs", 1975).  The files of a directory are estimated from
+   a random sample of ESTIMATE_SAMPLE of its entries.  Add the number of
+   directories read, entries read and lstat() calls to *EXAMINED, and set
+   *EXACT if nothing was chosen at random.  Files and subtrees of other
+   shards are left out, as by a sweep.  Files in use are only recognized by
+   a lease: running fuser for each file of the samples would cost more than
+   the sweep that the estimate is meant to spare.
+   Return 0 if OK, 1 if stopped by tmpwatch_stop(), -1 on fatal errors. */
+static int
+estimate_probe(struct tmpwatch *tw, int root_fd, const char *root,
+	       dev_t root_dev, ino_t root_ino,
+	       const struct tmpwatch_policy *policy,
+	       unsigned short xsubi[3], struct estimate_dir *ed,
+	       unsigned long *examined, double *files, double *bytes,
+	       int *exact)
+{
+    char *path;
+    size_t path_len, path_size;
+    double weight;
+    dev_t dev;
+    unsigned depth;
+    int fd, ret;
+
+    *files = 0;
+    *bytes = 0;
+    *exact = 1;
+    weight = 1;
+    path_len = strlen(root);
+    path_size = path_len + 1;
+    if ((path = malloc(path_size)) == NULL) {
+	message(tw, TMPWATCH_LOG_FATAL, "error allocating memory\n");
+	return -1;
+    }
+    memcpy(path, root, path_size);
+    /* Not a duplicate, which would share the offset of the last probe */
+    fd = open_subdir(root_fd, ".", root_dev, root_ino);
+    dev = root_dev;
+    depth = 0;
+    ret = 0;
+    while (fd != -1) {
+	struct filter_dir fdr;
+	struct stat sb;
+	const struct tmpwatch_policy *rule;
+	time_t significant_time, threshold;
+	unsigned long eligible;
+	uintmax_t eligible_bytes;
+	const char *name;
+	size_t i;
+	DIR *dir;
+	int res;
+
+	if (tw->stop_requested) {
+	    close(fd);
+	    ret = 1;
+	    break;
+	}
+	/* The filters examine entries in the current directory */
+	if (fchdir(fd) != 0 || (dir = fdopendir(fd)) == NULL) {
+	    message(tw, TMPWATCH_LOG_ERROR, "cannot read %s: %s\n", path,
+		    strerror(errno));
+	    close(fd);
+	    break;
+	}
+	(*examined)++;
+	res = read_estimate_dir(dir, ed, xsubi, examined);
+	if (res != 0) {
+	    closedir(dir);
+	    message(tw, TMPWATCH_LOG_FATAL, "error allocating memory\n");
+	    ret = -1;
+	    break;
+	}
+	if (ed->num_dirs > 1 || ed->num_sample != ed->num_files)
+	    *exact = 0;
+
+	/* Count the entries of the sample that would be removed */
+	filter_dir_init(&fdr, tw, policy, path, root_dev);
+	fdr.batch_fuser = 1;
+	eligible = 0;
+	eligible_bytes = 0;
+	for (i = 0; i < ed->num_sample; i++) {
+	    (*examined)++;
+	    if (lstat(ed->sample[i], &sb) == 0 && !S_ISDIR(sb.st_mode)
+		&& !other_shard(tw, depth, dev, sb.st_ino)
+		&& classify_entry(policy, &fdr, ed->sample[i], &sb,
+				  &significant_time, &threshold)
+		== TMPWATCH_KEPT_MAX) {
+		eligible++;
+		eligible_bytes += sb.st_size;
+	    }
+	}
+	if (ed->num_sample != 0) {
+	    *files += weight * eligible * ed->num_files / ed->num_sample;
+	    *bytes += weight * eligible_bytes * ed->num_files
+		/ ed->num_sample;
+	}
+
+	/* Continue in a random subdirectory, if a sweep would enter it */
+	fd = -1;
+	name = NULL;
+	if (ed->num_dirs != 0) {
+	    name = ed->dirs[nrand48(xsubi) % ed->num_dirs];
+	    (*examined)++;
+	    if (lstat(name, &sb) != 0 || !S_ISDIR(sb.st_mode)
+		|| classify_entry(policy, &fdr, name, &sb, &significant_time,
+				  &threshold) != TMPWATCH_KEPT_MAX
+		|| (depth + 1 == tw->shard_depth
+		    && other_shard(tw, depth, dev, sb.st_ino)))
+		name = NULL;
+	}
+	filter_dir_free(&fdr);
+	if (name != NULL && path_len + strlen(name) + 2 > path_size) {
+	    char *p;
+
+	    path_size = 2 * (path_len + strlen(name) + 2);
+	    if ((p = realloc(path, path_size)) == NULL) {
+		message(tw, TMPWATCH_LOG_FATAL, "error allocating memory\n");
+		ret = -1;
+		name = NULL;
+	    } else
+		path = p;
+	}
+	if (name != NULL) {
+	    path[path_len] = '/';
+	    strcpy(path + path_len + 1, name);
+	    path_len += strlen(name) + 1;
+	    if (!is_bind_mount(&tw->bind_mounts, path))
+		fd = open_subdir(dirfd(dir), name, sb.st_dev, sb.st_ino);
+	    /* A rule starts its own division into shards */
+	    if ((rule = lookup_rule(tw, sb.st_dev, sb.st_ino)) != NULL) {
+		policy = rule;
+		depth = 0;
+	    } else
+		depth++;
+	    dev = sb.st_dev;
+	    weight *= ed->num_dirs;
+	}
+	closedir(dir);
+	estimate_dir_clear(ed);
+    }
+    free(path);
+    return ret;
+}
+
+int
+tmpwatch_estimate(struct tmpwatch *tw, const char *root,
+		  const struct tmpwatch_policy *policy,
+		  unsigned long max_examined, struct tmpwatch_estimate *est)
+{
+    struct estimate_dir ed;
+    struct stat sb;
+    unsigned short xsubi[3];
+    double mean_files, mean_bytes, m2_files, m2_bytes;
+    int fd;
+
+    memset(est, 0, sizeof(*est));
+    tw->interrupted = 0;
+    tw->failed = 0;
+    if (lstat(root, &sb) != 0) {
+	message(tw, TMPWATCH_LOG_ERROR, "lstat() of directory %s failed: %s\n",
+		root, strerror(errno));
+	return -1;
+    }
+    if (S_ISLNK(sb.st_mode)) {
+	message(tw, TMPWATCH_LOG_DEBUG, "initial directory %s is a symlink "
+		"-- skipping\n", root);
+	est->exact = 1;
+	return 0;
+    }
+    if ((fd = open_subdir(AT_FDCWD, root, sb.st_dev, sb.st_ino)) == -1) {
+	message(tw, TMPWATCH_LOG_ERROR, "cannot open %s: %s\n", root,
+		strerror(errno));
+	return -1;
+    }
+
+    memset(&ed, 0, sizeof(ed));
+    xsubi[0] = 0x330e;
+    xsubi[1] = (unsigned short)tw->now;
+    xsubi[2] = (unsigned short)getpid();
+    /* Welford's method: mean and sum of squared deviations */
+    mean_files = mean_bytes = m2_files = m2_bytes = 0;
+    while (est->probes < 2 || est->examined < max_examined) {
+	double files, bytes, delta_files, delta_bytes;
+	int exact, res;
+
+	res = estimate_probe(tw, fd, root, sb.st_dev, sb.st_ino, policy,
+			     xsubi, &ed, &est->examined, &files, &bytes,
+			     &exact);
+	if (res != 0) {
+	    tw->interrupted = res == 1;
+	    break;
+	}
+	est->probes++;
+	delta_files = files - mean_files;
+	mean_files += delta_files / est->probes;
+	m2_files += delta_files * (files - mean_files);
+	delta_bytes = bytes - mean_bytes;
+	mean_bytes += delta_bytes / est->probes;
+	m2_bytes += delta_bytes * (bytes - mean_bytes);
+	/* Every probe would find the same */
+	if (exact) {
+	    est->exact = 1;
+	    break;
+	}
+    }
+    close(fd);
+    free(ed.dirs);
+
+    est->files = mean_files;
+    est->bytes = mean_bytes;
+    if (est->probes > 1) {
+	est->files_error = sqrt(m2_files / (est->probes - 1) / est->probes);
+	est->bytes_error = sqrt(m2_bytes / (est->probes - 1) / est->probes);
+    }
+    return tw->failed ? -1 : 0;
+}
+
+int
+tmpwatch_apply(struct tmpwatch *tw, const char *dir, const char *name,
+	       dev_t dev, ino_t ino, mode_t mode, int flags, time_t threshold,
+	       int reason)
+{
+    struct tmpwatch_entry entry;
+    struct stat sb;
+    int fields, gone;
+
+    if (lstat(name, &sb) != 0) {
+	if (errno != ENOENT && errno != EACCES)
+	    message(tw, TMPWATCH_LOG_ERROR, "failed to lstat %s/%s: %s\n",
+		    dir, name, strerror(errno));
+	return 0;
+    }
+    if (sb.st_dev != dev || sb.st_ino != ino
+	|| (sb.st_mode & S_IFMT) != (mode & S_IFMT)) {
+	message(tw, TMPWATCH_LOG_VERBOSE,
+		"%s/%s changed since the scan, skipping\n", dir, name);
+	return 0;
+    }
+
+    entry.dir = dir;
+    entry.dir_stat = NULL;
+    entry.name = name;
+    entry.stat = &sb;
+    entry.flags = flags;
+    entry.threshold = threshold;
+    entry.reason = reason;
+    entry.dir_data = NULL;
+    if (reason == TMPWATCH_REASON_EMPTYDIR) {
+	/* Removing the contents has changed the times of the directory; rmdir
+	   will refuse to remove it if anything was added since the scan. */
+	if ((tw->flags & TMPWATCH_NODIRS) != 0)
+	    return 0;
+	entry.time = entry_time(&sb, TIME_MTIME);
+	gone = remove_directory(tw, dir, name, &sb);
+    } else {
+	fields = significant_fields(flags, 0);
+	if (fields != 0)
+	    entry.time = entry_time(&sb, fields);
+	if (fields == 0 || entry.time >= threshold) {
+	    message(tw, TMPWATCH_LOG_VERBOSE,
+		    "%s/%s was used since the scan, skipping\n", dir, name);
+	    return 0;
+	}
+
+	if ((tw->flags & TMPWATCH_FUSER) != 0 && file_in_use(name, &sb)) {
+	    message(tw, TMPWATCH_LOG_VERBOSE,
+		    "file is already in use or open: %s/%s\n", dir, name);
+	    return 0;
+	}
+	gone = remove_file(tw, &entry);
+    }
+    if (gone && tw->callbacks.removed != NULL)
+	tw->callbacks.removed(tw->data, &entry);
+    return gone;
+}
+
+struct tmpwatch *
+tmpwatch_new(int flags, const char *shred_path, int log_level,
+	     const struct tmpwatch_callbacks *callbacks, void *data)
+{
+    struct tmpwatch *tw;
+
+    if ((tw = calloc(1, sizeof(*tw))) == NULL)
+	return NULL;
+    tw->flags = flags;
+    tw->shred_path = shred_path;
+    tw->log_level = log_level;
+    if (callbacks != NULL)
+	tw->callbacks = *callbacks;
+    tw->data = data;
+    tw->max_open_dirs = TMPWATCH_DEFAULT_OPEN_DIRS;
+    tw->shard_count = 1;
+    tw->trash_fd = -1;
+    tw->fs = &posix_fs_ops;
+    tw->fs_data = &tw->bind_mounts;
+
+    /* Connecting to an AF_UNIX socket does not update any of its times, so
+       we can't blindly remove a socket with old times - but any process
+       listening on that socket can not survive a reboot, so sockets that
+       predate the time of our boot are fair game. */
+    tw->now = time(NULL);
+/* We want __linux because the behavior of CLOCK_BOOTTIME is not standardized.
+   On Linux, it is the time since system boot, including the time spent in
+   sleep mode or hibernation. */
+#if defined (HAVE_CLOCK_GETTIME) && defined (CLOCK_BOOTTIME) && defined (__linux)
+    struct timespec real_clock, boot_clock;
+
+    if (clock_gettime(CLOCK_REALTIME, &real_clock) != 0
+	|| clock_gettime(CLOCK_BOOTTIME, &boot_clock) != 0) {
+	free(tw);
+	return NULL;
+    }
+    tw->boot_time = real_clock.tv_sec - boot_clock.tv_sec;
+    if (real_clock.tv_nsec < boot_clock.tv_nsec)
+	tw->boot_time--;
+    /* We don't get the values of the two clocks at exactly the same moment,
+       let's add a few seconds to be extra sure. */
+    tw->boot_time -= 2;
+#endif
+
+    bind_mount_init(&tw->bind_mounts);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&tw->progress_lock, NULL);
+#endif
+    return tw;
+}
+
+void
+tmpwatch_free(struct tmpwatch *tw)
+{
+    struct tmpwatch_policy *p, *next;
+
+    for (p = tw->policies; p != NULL; p = next) {
+	struct exclusion *e, *e_next;
+	struct excluded_pattern *ep, *ep_next;
+	struct excluded_uid *u, *u_next;
+
+	next = p->next;
+	for (e = p->exclusions; e != NULL; e = e_next) {
+	    e_next = e->next;
+	    free(e->path);
+	    free(e);
+	}
+	for (ep = p->excluded_patterns; ep != NULL; ep = ep_next) {
+	    ep_next = ep->next;
+	    free(ep->pattern);
+	    free(ep);
+	}
+	for (u = p->excluded_uids; u != NULL; u = u_next) {
+	    u_next = u->next;
+	    free(u);
+	}
+	free(p->root);
+	free(p);
+    }
+    free(tw->rules);
+    frontier_free(tw);
+    free(tw->frontier);
+    end_resume(tw);
+    free(tw->resume_levels);
+    free(tw->levels);
+    free(tw->path);
+    free(tw->progress_path);
+    if (tw->truncator != NULL)
+	truncator_finish(tw->truncator);
+    unix_sockets_free(&tw->unix_sockets);
+    bind_mount_free(&tw->bind_mounts);
+    free(tw->quarantine);
+    free(tw->fuser_waiting);
+    free(tw->shred_batch.files);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&tw->progress_lock);
+#endif
+    free(tw);
+}
+
+/* Build the filter programs of POLICY for its settings */
+static void
+compile_filters(struct tmpwatch_policy *policy)
+{
+    const struct exclusion *e;
+    unsigned char *op;
+
+    memset(policy->names, 0, sizeof(policy->names));
+    for (e = policy->exclusions; e != NULL; e = e->next)
+	add_policy_name(policy, e->file);
+#ifdef __linux
+    add_policy_name(policy, ".journal");
+    add_policy_name(policy, "aquota.user");
+    add_policy_name(policy, "aquota.group");
+#endif
+
+    op = policy->filters;
+    *op++ = FILTER_DEVICE;
+    if ((policy->flags & TMPWATCH_FORCE) == 0)
+	*op++ = FILTER_ROOT_READONLY;
+    *op++ = FILTER_LOST_FOUND;
+    if (policy->exclusions != NULL)
+	*op++ = FILTER_EXCLUSION;
+    if (policy->excluded_patterns != NULL)
+	*op++ = FILTER_PATTERN;
+    *op = FILTER_END;
+
+    op = policy->file_filters;
+    if ((policy->flags & TMPWATCH_ALLFILES) == 0)
+	*op++ = FILTER_TYPE;
+    if (policy->excluded_uids != NULL)
+	*op++ = FILTER_UID;
+#ifdef __linux
+    *op++ = FILTER_SPECIAL;
+#endif
+    /* May fork() fuser, so it goes last */
+    if ((policy->flags & TMPWATCH_FUSER) != 0)
+	*op++ = FILTER_FUSER;
+    *op = FILTER_END;
+}
+
+struct tmpwatch_policy *
+tmpwatch_policy_new(struct tmpwatch *tw, const char *root, int flags,
+		    int grace)
+{
+    struct tmpwatch_policy *policy;
+    int grace_seconds;
+
+    if (grace < 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    if ((policy = calloc(1, sizeof(*policy))) == NULL)
+	return NULL;
+    if (root != NULL && (policy->root = strdup(root)) == NULL) {
+	free(policy);
+	return NULL;
+    }
+    policy->flags = flags;
+    policy->grace = grace;
+    policy->exclusions_tail = &policy->exclusions;
+    policy->excluded_patterns_tail = &policy->excluded_patterns;
+    policy->excluded_uids_tail = &policy->excluded_uids;
+    policy->dir_fields = significant_fields(flags, 1);
+    policy->file_fields = significant_fields(flags, 0);
+    /* What? One or the other should be set by now... */
+    if (policy->dir_fields == 0 || policy->file_fields == 0) {
+	free(policy->root);
+	free(policy);
+	errno = EINVAL;
+	return NULL;
+    }
+
+    /* We still add the grace period to the boot time, both as a layer of
+       extra protection, and to let users examine contents of the temporary
+       directory for at least for some time. */
+    grace_seconds = grace * 60;
+    message(tw, TMPWATCH_LOG_DEBUG, "grace period is %d seconds\n",
+	    grace_seconds);
+    policy->kill_time = tw->now - grace_seconds;
+    if ((flags & TMPWATCH_ALLFILES) != 0)
+	policy->socket_kill_time = policy->kill_time;
+    else if (tw->boot_time != 0)
+	policy->socket_kill_time = tw->boot_time - grace_seconds;
+    else
+	policy->socket_kill_time = 0; /* Never remove sockets */
+
+    compile_filters(policy);
+    policy->next = tw->policies;
+    tw->policies = policy;
+    return policy;
+}
+
+int
+tmpwatch_policy_exclude(struct tmpwatch_policy *policy, const char *path)
+{
+    char buf[PATH_MAX + 1];
+    struct exclusion *e;
+    const char *src;
+    char *p;
+
+    src = realpath(path, buf);
+    if (src == NULL)
+	src = path;
+    if (*src != '/') {
+	errno = EINVAL;
+	return -1;
+    }
+    if ((e = malloc(sizeof (*e))) == NULL)
+	return -1;
+    if ((e->path = strdup(src)) == NULL) {
+	free(e);
+	return -1;
+    }
+    p = strrchr(e->path, '/');
+    e->file = p + 1;
+    if (p == e->path)
+	e->dir = "/";
+    else {
+	*p = 0;
+	e->dir = e->path;
+    }
+    e->next = NULL;
+    *policy->exclusions_tail = e;
+    policy->exclusions_tail = &e->next;
+    compile_filters(policy);
+    return 0;
+}
+
+int
+tmpwatch_policy_exclude_uid(struct tmpwatch_policy *policy, uid_t uid)
+{
+    struct excluded_uid *u;
+
+    if ((u = malloc(sizeof (*u))) == NULL)
+	return -1;
+    u->uid = uid;
+    u->next = NULL;
+    *policy->excluded_uids_tail = u;
+    policy->excluded_uids_tail = &u->next;
+    compile_filters(policy);
+    return 0;
+}
+
+int
+tmpwatch_policy_exclude_pattern(struct tmpwatch_policy *policy,
+				const char *pattern)
+{
+    struct excluded_pattern *p;
+
+    if ((p = malloc(sizeof (*p))) == NULL)
+	return -1;
+    if ((p->pattern = strdup(pattern)) == NULL) {
+	free(p);
+	return -1;
+    }
+    p->next = NULL;
+    *policy->excluded_patterns_tail = p;
+    policy->excluded_patterns_tail = &p->next;
+    compile_filters(policy);
+    return 0;
+}
+
+const char *
+tmpwatch_policy_root(const struct tmpwatch_policy *policy)
+{
+    return policy->root;
+}
+
+int
+tmpwatch_policy_visited(const struct tmpwatch_policy *policy)
+{
+    return policy->visited;
+}
+
+int
+tmpwatch_add_rule(struct tmpwatch *tw, struct tmpwatch_policy *policy)
+{
+    struct stat sb;
+    size_t i;
+
+    if (policy->root == NULL || *policy->root != '/') {
+	errno = EINVAL;
+	return -1;
+    }
+    /* A rule is found by the identity of its root, so that it applies however
+       the directory is reached; a missing root can't be reached anyway */
+    if (tw->fs->lstat(tw->fs_data, policy->root, &sb) == 0
+	&& S_ISDIR(sb.st_mode)) {
+	for (i = 0; i < tw->num_rules; i++) {
+	    if (tw->rules[i]->root_dev == sb.st_dev
+		&& tw->rules[i]->root_ino == sb.st_ino) {
+		errno = EEXIST;
+		return -1;
+	    }
+	}
+	policy->root_dev = sb.st_dev;
+	policy->root_ino = sb.st_ino;
+    }
+    if (tw->num_rules == tw->rules_allocated) {
+	struct tmpwatch_policy **p;
+	size_t allocated;
+
+	allocated = tw->rules_allocated == 0 ? 16 : 2 * tw->rules_allocated;
+	p = reallocarray(tw->rules, allocated, sizeof(*tw->rules));
+	if (p == NULL)
+	    return -1;
+	tw->rules = p;
+	tw->rules_allocated = allocated;
+    }
+    tw->rules[tw->num_rules++] = policy;
+    tw->rules_sorted = 0;
+    return 0;
+}
+
+/* Open the quarantine of TW in ROOT, on device ROOT_DEV, creating it if
+   necessary, as tw->trash_fd.
+   Return 0 if OK, -1 with errno set. */
+static int
+open_trash(struct tmpwatch *tw, const char *root, dev_t root_dev)
+{
+    struct stat sb;
+    int root_fd, fd, err;
+
+    root_fd = open(root, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (root_fd == -1)
+	return -1;
+    if (mkdirat(root_fd, tw->quarantine, 0700) != 0 && errno != EEXIST) {
+	err = errno;
+	close(root_fd);
+	errno = err;
+	return -1;
+    }
+    fd = openat(root_fd, tw->quarantine,
+		O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    err = errno;
+    close(root_fd);
+    if (fd == -1) {
+	errno = err;
+	return -1;
+    }
+    /* Anybody may have created it in a world-writable ROOT */
+    if (fstat(fd, &sb) != 0 || sb.st_uid != geteuid()
+	|| (sb.st_mode & 077) != 0 || sb.st_dev != root_dev) {
+	close(fd);
+	errno = EPERM;
+	return -1;
+    }
+    tw->trash_fd = fd;
+    tw->trash_dev = sb.st_dev;
+    tw->trash_ino = sb.st_ino;
+    return 0;
+}
+
+int
+tmpwatch_sweep(struct tmpwatch *tw, const char *root,
+	       struct tmpwatch_policy *policy)
+{
+    struct stat sb;
+    size_t i;
+
+    tw->interrupted = 0;
+    tw->failed = 0;
+    frontier_free(tw);
+    policy->visited = 1;
+
+    if (tw->fs->lstat(tw->fs_data, root, &sb) != 0) {
+	message(tw, TMPWATCH_LOG_ERROR, "lstat() of directory %s failed: %s\n",
+		root, strerror(errno));
+	return -1;
+    }
+
+    if (S_ISLNK(sb.st_mode)) {
+	message(tw, TMPWATCH_LOG_DEBUG, "initial directory %s is a symlink "
+		"-- skipping\n", root);
+	return 0;
+    }
+    if (tw->quarantine != NULL && (tw->flags & TMPWATCH_TEST) == 0
+	&& open_trash(tw, root, sb.st_dev) != 0)
+	message(tw, TMPWATCH_LOG_ERROR, "cannot use the quarantine %s/%s, "
+		"removing entries: %s\n", root, tw->quarantine,
+		strerror(errno));
+    if (tw->pipeline_len != 0
+	&& (tw->deleter = deleter_start(tw->pipeline_len)) == NULL)
+	message(tw, TMPWATCH_LOG_ERROR, "cannot start removing entries in "
+		"a separate thread: %s\n", strerror(errno));
+    cleanupDirectory(tw, root, sb.st_dev, sb.st_ino, policy);
+    if (tw->trash_fd != -1) {
+	close(tw->trash_fd);
+	tw->trash_fd = -1;
+    }
+    if (tw->deleter != NULL) {
+	report_failures(tw, deleter_finish(tw->deleter));
+	tw->deleter = NULL;
+    }
+    set_progress_path(tw, "");
+
+    /* The frontier was collected innermost first */
+    for (i = 0; i < tw->frontier_len / 2; i++) {
+	struct tmpwatch_position tmp;
+
+	tmp = tw->frontier[i];
+	tw->frontier[i] = tw->frontier[tw->frontier_len - 1 - i];
+	tw->frontier[tw->frontier_len - 1 - i] = tmp;
+    }
+    return tw->failed ? -1 : 0;
+}
+
+int
+tmpwatch_purge_quarantine(struct tmpwatch *tw, const char *root)
+{
+    struct tmpwatch_policy *policy;
+    struct stat sb, root_sb;
+    char *path, *quarantine;
+    int res;
+
+    if (tw->quarantine == NULL) {
+	errno = EINVAL;
+	return -1;
+    }
+    if (asprintf(&path, "%s/%s", root, tw->quarantine) == -1)
+	return -1;
+    if (tw->fs->lstat(tw->fs_data, path, &sb) != 0) {
+	if (errno == ENOENT) {
+	    message(tw, TMPWATCH_LOG_DEBUG, "no quarantine in %s\n", root);
+	    free(path);
+	    return 0;
+	}
+	message(tw, TMPWATCH_LOG_ERROR, "cannot stat %s: %s\n", path,
+		strerror(errno));
+	free(path);
+	return -1;
+    }
+    /* As in open_trash(): anybody may have created it in a world-writable
+       ROOT, and a sweep of it removes everything */
+    if (tw->fs->lstat(tw->fs_data, root, &root_sb) != 0
+	|| !S_ISDIR(root_sb.st_mode) || !S_ISDIR(sb.st_mode)
+	|| sb.st_uid != geteuid() || (sb.st_mode & 077) != 0
+	|| sb.st_dev != root_sb.st_dev) {
+	message(tw, TMPWATCH_LOG_ERROR,
+		"%s is not a private directory of this user, not purging it\n",
+		path);
+	free(path);
+	errno = EPERM;
+	return -1;
+    }
+    /* Everything in the quarantine has already been selected for removal */
+    policy = tmpwatch_policy_new(tw, NULL, TMPWATCH_ALLFILES | TMPWATCH_FORCE
+				 | TMPWATCH_MTIME, 0);
+    if (policy == NULL) {
+	free(path);
+	return -1;
+    }
+    policy->kill_time = TIME_T_MAX;
+    policy->socket_kill_time = TIME_T_MAX;
+    quarantine = tw->quarantine;
+    tw->quarantine = NULL;
+    res = tmpwatch_sweep(tw, path, policy);
+    tw->quarantine = quarantine;
+    free(path);
+    return res;
+}
+
+int
+tmpwatch_set_max_open_dirs(struct tmpwatch *tw, size_t n)
+{
+    if (n == 0) {
+	errno = EINVAL;
+	return -1;
+    }
+    tw->max_open_dirs = n;
+    return 0;
+}
+
+int
+tmpwatch_set_pipeline(struct tmpwatch *tw, size_t queue_len)
+{
+#ifndef HAVE_PTHREAD_H
+    if (queue_len != 0) {
+	errno = ENOSYS;
+	return -1;
+    }
+#endif
+    /* The deleter needs a descriptor of each directory */
+    if (queue_len != 0 && tw->fs != &posix_fs_ops) {
+	errno = EINVAL;
+	return -1;
+    }
+    tw->pipeline_len = queue_len;
+    return 0;
+}
+
+int
+tmpwatch_set_shard(struct tmpwatch *tw, unsigned index, unsigned count,
+		   unsigned depth)
+{
+    if (count == 0 || index >= count || (count > 1 && depth == 0)) {
+	errno = EINVAL;
+	return -1;
+    }
+    tw->shard_index = index;
+    tw->shard_count = count;
+    tw->shard_depth = count > 1 ? depth : 0;
+    return 0;
+}
+
+int
+tmpwatch_set_quarantine(struct tmpwatch *tw, const char *name)
+{
+    char *copy;
+
+    if (name != NULL && (*name == '\0' || strchr(name, '/') != NULL
+			 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)) {
+	errno = EINVAL;
+	return -1;
+    }
+    /* Entries are moved by renameat() in the real filesystem */
+    if (name != NULL && tw->fs != &posix_fs_ops) {
+	errno = EINVAL;
+	return -1;
+    }
+    copy = NULL;
+    if (name != NULL && (copy = strdup(name)) == NULL)
+	return -1;
+    free(tw->quarantine);
+    tw->quarantine = copy;
+    return 0;
+}
+
+int
+tmpwatch_set_truncate(struct tmpwatch *tw, off_t min_size, off_t step,
+		      unsigned pause_ms)
+{
+#if !defined (HAVE_PTHREAD_H) || !defined (F_SETLEASE)
+    if (min_size != 0) {
+	errno = ENOSYS;
+	return -1;
+    }
+#endif
+    if (min_size < 0 || (min_size != 0 && step <= 0)) {
+	errno = EINVAL;
+	return -1;
+    }
+    /* Files are opened in the real filesystem */
+    if (min_size != 0 && tw->fs != &posix_fs_ops) {
+	errno = EINVAL;
+	return -1;
+    }
+    tw->truncate_size = min_size;
+    tw->truncate_step = step;
+    tw->truncate_pause = pause_ms;
+    return 0;
+}
+
+int
+tmpwatch_set_fs(struct tmpwatch *tw, const struct tmpwatch_fs_ops *ops,
+		void *fs)
+{
+    if (ops != NULL
+	&& ((tw->flags & (TMPWATCH_FUSER | TMPWATCH_SHRED)) != 0
+	    || tw->pipeline_len != 0 || tw->truncate_size != 0
+	    || tw->quarantine != NULL)) {
+	errno = EINVAL;
+	return -1;
+    }
+    tw->fs = ops != NULL ? ops : &posix_fs_ops;
+    tw->fs_data = ops != NULL ? fs : &tw->bind_mounts;
+    return 0;
+}
+
+void
+tmpwatch_progress(struct tmpwatch *tw, struct tmpwatch_progress *progress,
+		  char *path, size_t path_size)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&tw->progress_lock);
+#endif
+    *progress = tw->progress;
+    if (path_size != 0) {
+	path[0] = '\0';
+	if (tw->progress_path != NULL) {
+	    strncpy(path, tw->progress_path, path_size - 1);
+	    path[path_size - 1] = '\0';
+	}
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&tw->progress_lock);
+#endif
+}
+
+void
+tmpwatch_stop(struct tmpwatch *tw)
+{
+    tw->stop_requested = 1;
+}
+
+int
+tmpwatch_interrupted(const struct tmpwatch *tw)
+{
+    return tw->interrupted;
+}
+
+size_t
+tmpwatch_frontier(const struct tmpwatch *tw,
+		  const struct tmpwatch_position **levels)
+{
+    *levels = tw->frontier;
+    return tw->frontier_len;
+}
+
+int
+tmpwatch_resume(struct tmpwatch *tw, const struct tmpwatch_position *levels,
+		size_t n)
+{
+    size_t i;
+
+    end_resume(tw);
+    if (n > tw->resume_levels_allocated) {
+	struct tmpwatch_position *p;
+
+	p = reallocarray(tw->resume_levels, n, sizeof(*tw->resume_levels));
+	if (p == NULL)
+	    return -1;
+	tw->resume_levels = p;
+	tw->resume_levels_allocated = n;
+    }
+    for (i = 0; i < n; i++) {
+	tw->resume_levels[i] = levels[i];
+	if ((tw->resume_levels[i].name = strdup(levels[i].name)) == NULL) {
+	    tw->num_resume_levels = i;
+	    end_resume(tw);
+	    return -1;
+	}
+    }
+    tw->num_resume_levels = n;
+    return 0;
+}
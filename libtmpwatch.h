@@ -0,0 +1,385 @@
+/* libtmpwatch.h -- remove old files in directory trees, as a library
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef LIBTMPWATCH_H__
+#define LIBTMPWATCH_H__
+
+#include <dirent.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* All state of the library is kept in a struct tmpwatch, so independent
+   sweeps may run in one process (but not concurrently on one struct
+   tmpwatch).  The only exception is the table of bind mounts, which
+   describes the whole process and is shared, and refreshed only when the
+   kernel reports a change of the mount table. */
+
+/* Flags of struct tmpwatch and struct tmpwatch_policy */
+#define TMPWATCH_FORCE		(1 << 0) /* Ignore write permission */
+/* normally just files, dirs, and sockets older than (boot time - grace
+   period) are removed */
+#define TMPWATCH_ALLFILES	(1 << 1)
+#define TMPWATCH_TEST		(1 << 2) /* Don't remove anything */
+#define TMPWATCH_ATIME		(1 << 3)
+#define TMPWATCH_MTIME		(1 << 4)
+#define TMPWATCH_FUSER		(1 << 5) /* Skip files in use */
+#define TMPWATCH_CTIME		(1 << 6)
+#define TMPWATCH_NODIRS		(1 << 7)
+#define TMPWATCH_NOSYMLINKS	(1 << 8)
+#define TMPWATCH_DIRMTIME	(1 << 9)
+#define TMPWATCH_SHRED		(1 <<10) /* Shred files before removing them */
+#define TMPWATCH_CHECKPOINT	(1 <<11) /* For tmpwatch_frontier() */
+#define TMPWATCH_PROFILE	(1 <<12) /* Call the profile callback */
+/* Sockets that no socket is bound to expire like other files */
+#define TMPWATCH_UNBOUND_SOCKETS (1 <<13)
+
+#define TMPWATCH_TIME_FLAGS	(TMPWATCH_ATIME | TMPWATCH_MTIME \
+				 | TMPWATCH_CTIME | TMPWATCH_DIRMTIME)
+
+/* Message levels */
+#define TMPWATCH_LOG_REALDEBUG	1
+#define TMPWATCH_LOG_DEBUG	2
+#define TMPWATCH_LOG_VERBOSE	3
+#define TMPWATCH_LOG_NORMAL	4
+#define TMPWATCH_LOG_ERROR	5
+#define TMPWATCH_LOG_FATAL	6 /* The sweep is abandoned */
+
+/* Reasons for removing an entry */
+#define TMPWATCH_REASON_EXPIRED		1 /* older than the kill time */
+#define TMPWATCH_REASON_SOCKET		2 /* unused socket older than the
+					     socket kill time */
+#define TMPWATCH_REASON_EMPTYDIR	3 /* expired directory, removed if
+					     empty */
+
+/* Results of the decide callback */
+#define TMPWATCH_REMOVE	0	/* Remove the entry */
+#define TMPWATCH_KEEP	1	/* Leave the entry alone */
+#define TMPWATCH_DEFER	2	/* The caller takes care of the entry; treat it
+				   as removed */
+
+/* What to remove from a directory tree */
+struct tmpwatch_policy;
+
+/* An entry about to be removed, or just removed */
+struct tmpwatch_entry
+{
+    const char *dir;		/* Absolute path of the directory */
+    const struct stat *dir_stat;
+    const char *name;		/* In the current directory */
+    const struct stat *stat;
+    int flags;			/* TMPWATCH_* of the policy */
+    time_t time;		/* Significant time */
+    time_t threshold;		/* TIME is older than this */
+    int reason;			/* TMPWATCH_REASON_* */
+    long *dir_data;		/* For use by the callback, -1 when each
+				   directory is entered */
+};
+
+/* Reasons for keeping an entry, counted in struct tmpwatch_dir_profile */
+#define TMPWATCH_KEPT_ERROR		0  /* lstat() failed */
+#define TMPWATCH_KEPT_DEVICE		1  /* On a different filesystem */
+#define TMPWATCH_KEPT_ROOT_READONLY	2  /* Non-writable, owned by root */
+#define TMPWATCH_KEPT_LOST_FOUND	3
+#define TMPWATCH_KEPT_EXCLUDED		4  /* tmpwatch_policy_exclude() */
+#define TMPWATCH_KEPT_PATTERN		5  /* ..._exclude_pattern() */
+#define TMPWATCH_KEPT_RECENT		6  /* Not old enough */
+#define TMPWATCH_KEPT_TYPE		7  /* Not removed without ALLFILES */
+#define TMPWATCH_KEPT_UID		8  /* tmpwatch_policy_exclude_uid() */
+#define TMPWATCH_KEPT_SPECIAL		9  /* ext3 journal or quota file */
+#define TMPWATCH_KEPT_IN_USE		10 /* With TMPWATCH_FUSER */
+#define TMPWATCH_KEPT_NOT_EMPTY		11 /* A directory */
+#define TMPWATCH_KEPT_NODIRS		12 /* A directory, with NODIRS */
+#define TMPWATCH_KEPT_NOT_REMOVED	13 /* Kept by the decide callback, or
+					      removing it failed */
+#define TMPWATCH_KEPT_SHARD		14 /* Left to another shard */
+#define TMPWATCH_KEPT_MAX		15
+
+/* Costs of cleaning up a directory, not including its subdirectories */
+struct tmpwatch_dir_profile
+{
+    const char *dir;		/* Absolute path */
+    unsigned depth;		/* Below the root of the sweep */
+    unsigned long entries;	/* Read from the directory */
+    unsigned long stats;	/* lstat() calls */
+    /* Wall-clock times, in nanoseconds */
+    uint64_t time;		/* All time spent in the directory */
+    uint64_t readdir_time, stat_time, unlink_time, rmdir_time;
+    /* Sizes of files old enough to be removed, and of those removed (or that
+       would be with TMPWATCH_TEST, or left to the decide callback) */
+    uintmax_t eligible_bytes, removed_bytes;
+    unsigned long kept[TMPWATCH_KEPT_MAX]; /* Entries, by reason */
+};
+
+struct tmpwatch_callbacks
+{
+    /* Report a message at LEVEL; may be NULL */
+    void (*log)(void *data, int level, const char *format, va_list args);
+    /* Return TMPWATCH_REMOVE, TMPWATCH_KEEP or TMPWATCH_DEFER for ENTRY;
+       may be NULL to remove all entries */
+    int (*decide)(void *data, const struct tmpwatch_entry *entry);
+    /* ENTRY was removed (or would be, with TMPWATCH_TEST, or is waiting to
+       be removed with tmpwatch_set_pipeline()); may be NULL */
+    void (*removed)(void *data, const struct tmpwatch_entry *entry);
+    /* Cleaning up a directory, after its subdirectories, is finished;
+       called only with TMPWATCH_PROFILE.  May be NULL. */
+    void (*profile)(void *data, const struct tmpwatch_dir_profile *profile);
+};
+
+/* A position in a directory tree, to resume an interrupted sweep */
+struct tmpwatch_position
+{
+    dev_t dev;
+    ino_t ino;			/* Of the directory */
+    long pos;			/* telldir() cookie of NAME */
+    char *name;			/* The first entry not handled yet */
+};
+
+/* TMPWATCH_FUSER and tmpwatch_set_truncate() take file leases, whose breaks
+   by other processes are signalled with SIGIO; its default action
+   terminates the process.  A program using them must ignore or handle
+   SIGIO.  The leases are released without waiting for the signal. */
+
+/* Return a new sweep context with FLAGS, using SHRED_PATH for
+   TMPWATCH_SHRED, reporting messages at LOG_LEVEL and above to CALLBACKS,
+   which get DATA as their first argument.  Times of entries are compared with
+   the time of this call.
+   Return NULL with errno set on error. */
+extern struct tmpwatch *
+tmpwatch_new(int flags, const char *shred_path, int log_level,
+	     const struct tmpwatch_callbacks *callbacks, void *data);
+
+/* Free TW and all its policies */
+extern void tmpwatch_free(struct tmpwatch *tw);
+
+/* Return a new policy of TW for ROOT (an absolute path, or NULL), removing
+   entries older than GRACE minutes according to FLAGS.
+   Return NULL with errno set on error. */
+extern struct tmpwatch_policy *
+tmpwatch_policy_new(struct tmpwatch *tw, const char *root, int flags,
+		    int grace);
+
+/* Skip PATH (and its contents, if it is a directory) in POLICY.
+   Return 0 if OK, -1 with errno set (EINVAL if PATH is not absolute). */
+extern int tmpwatch_policy_exclude(struct tmpwatch_policy *policy,
+				   const char *path);
+
+/* Skip files owned by UID in POLICY.
+   Return 0 if OK, -1 with errno set. */
+extern int tmpwatch_policy_exclude_uid(struct tmpwatch_policy *policy,
+				       uid_t uid);
+
+/* Skip paths matching the fnmatch() PATTERN in POLICY.
+   Return 0 if OK, -1 with errno set. */
+extern int tmpwatch_policy_exclude_pattern(struct tmpwatch_policy *policy,
+					   const char *pattern);
+
+extern const char *tmpwatch_policy_root(const struct tmpwatch_policy *policy);
+
+/* Return nonzero if the root of POLICY was reached by a sweep */
+extern int tmpwatch_policy_visited(const struct tmpwatch_policy *policy);
+
+/* Use POLICY for its root whenever a sweep of TW reaches it, instead of the
+   policy of the parent directory.  The root is identified by its device and
+   inode at the time of this call, so it matches whatever path reaches it; a
+   sweep that reaches a root visited before leaves its contents alone.
+   Return 0 if OK, -1 with errno set (EEXIST if TW has a rule for the same
+   directory). */
+extern int tmpwatch_add_rule(struct tmpwatch *tw,
+			     struct tmpwatch_policy *policy);
+
+/* Clean up ROOT, an absolute path, using POLICY and the rules of TW.
+   The current directory is changed.
+   Return 0 if OK (even if some entries could not be examined), -1 if ROOT can
+   not be examined or after a TMPWATCH_LOG_FATAL message. */
+extern int tmpwatch_sweep(struct tmpwatch *tw, const char *root,
+			  struct tmpwatch_policy *policy);
+
+/* Result of tmpwatch_estimate() */
+struct tmpwatch_estimate
+{
+    unsigned long probes;	/* Random walks from the root */
+    unsigned long examined;	/* Directories, entries read and lstat() calls */
+    int exact;			/* The whole tree was examined */
+    /* Expected number and total size of the files to be removed, and the
+       standard errors of these estimates */
+    double files, files_error;
+    double bytes, bytes_error;
+};
+
+/* Estimate the files that tmpwatch_sweep(TW, ROOT, POLICY) would remove,
+   by random walks from ROOT that examine a sample of the files of each
+   directory on the way, until about MAX_EXAMINED directories and entries
+   are examined or tmpwatch_stop() is called.  Nothing is removed, and
+   directories are not counted.  Files of other shards are left out; with
+   TMPWATCH_FUSER, files in use are recognized only if a lease can tell,
+   without running fuser.  The current directory is changed.
+   Return 0 if OK, -1 if ROOT can not be examined or after a
+   TMPWATCH_LOG_FATAL message. */
+extern int tmpwatch_estimate(struct tmpwatch *tw, const char *root,
+			     const struct tmpwatch_policy *policy,
+			     unsigned long max_examined,
+			     struct tmpwatch_estimate *est);
+
+/* Keep at most N (at least 1, 64 by default) directories open while
+   sweeping with TW; directories outside of them are closed and opened again
+   when needed, checking their identity.  Besides the open directories, a
+   sweep uses about 700 bytes plus the length of the name for each level of
+   the tree.
+   Return 0 if OK, -1 with errno set. */
+extern int tmpwatch_set_max_open_dirs(struct tmpwatch *tw, size_t n);
+
+#define TMPWATCH_DEFAULT_OPEN_DIRS 64
+
+/* Remove entries in a separate thread while sweeping with TW, so that slow
+   removals don't hold up the walk, with at most QUEUE_LEN entries waiting
+   to be removed; 0, the default, removes each entry at once.  Each entry is
+   examined again just before it is removed, and left alone if it was
+   replaced.  A directory with waiting entries keeps a file descriptor open
+   until they are removed.  Files are still shredded by the walk.
+   Return 0 if OK, -1 with errno set (ENOSYS if threads are not supported,
+   EINVAL with tmpwatch_set_fs()). */
+extern int tmpwatch_set_pipeline(struct tmpwatch *tw, size_t queue_len);
+
+/* Clean up only shard INDEX of COUNT of the trees swept with TW, so that
+   COUNT processes sweeping the same trees with the same COUNT and DEPTH, one
+   for each INDEX, together sweep each tree once, without coordination.  The
+   entries DEPTH levels below the root of each rule (1 = the entries of the
+   root) are divided among the shards by their device and inode numbers, and
+   each of them, with all of its subtree, is handled only by its shard.
+   Files above DEPTH are divided the same way, while directories above DEPTH
+   are searched by every shard and removed only by their own, if they are
+   empty by then.  COUNT 1, the default, sweeps everything.
+   Return 0 if OK, -1 with errno set. */
+extern int tmpwatch_set_shard(struct tmpwatch *tw, unsigned index,
+			      unsigned count, unsigned depth);
+
+/* Instead of removing expired entries other than directories, move them to
+   the directory NAME in the root of each sweep of TW, created with mode 0700
+   if necessary, so that a sweep only renames them; the quarantine is skipped
+   by the sweeps and emptied by tmpwatch_purge_quarantine(), e.g. at a quieter
+   time.  Entries that can not be renamed within the filesystem of the root
+   are removed as usual.  NAME NULL, the default, removes entries at once.
+   Return 0 if OK, -1 with errno set (EINVAL with tmpwatch_set_fs()). */
+extern int tmpwatch_set_quarantine(struct tmpwatch *tw, const char *name);
+
+/* Remove everything in the quarantine of TW in ROOT, if it exists, by a
+   sweep of it regardless of the times of its entries.  A quarantine that is
+   not a directory owned by the effective user, accessible only to it and on
+   the filesystem of ROOT is left alone.
+   Return 0 if OK, -1 on error (EINVAL without tmpwatch_set_quarantine(),
+   EPERM for such a quarantine). */
+extern int tmpwatch_purge_quarantine(struct tmpwatch *tw, const char *root);
+
+/* Free the blocks of regular files of MIN_SIZE bytes or more removed by
+   sweeps of TW in a separate thread: each file is unlinked, then truncated
+   by STEP bytes at a time with a pause of PAUSE_MS milliseconds after each
+   step, and closed, so that freeing a huge file does not stall the sweep or
+   other users of the filesystem.  MIN_SIZE 0, the default, removes all files
+   at once.  Files that have other links, or are open in another process,
+   are removed at once too.  tmpwatch_free() waits until all files are freed.
+   SIGIO must be ignored or handled, as for TMPWATCH_FUSER.
+   Return 0 if OK, -1 with errno set (ENOSYS if threads or leases are not
+   supported, EINVAL with tmpwatch_set_fs()). */
+extern int tmpwatch_set_truncate(struct tmpwatch *tw, off_t min_size,
+				 off_t step, unsigned pause_ms);
+
+/* Filesystem access of a sweep.  Names are relative to a current directory
+   kept by the backend, as for the POSIX function of the same name, and each
+   operation returns as that function does, with errno set on error.  FS is
+   the argument given to tmpwatch_set_fs(); DIR is returned by opendir. */
+struct tmpwatch_fs_ops
+{
+    int (*lstat)(void *fs, const char *path, struct stat *sb);
+    int (*chdir)(void *fs, const char *path);
+    /* Open the current directory for reading; set *TOUCHED if reading it
+       may update its atime */
+    void *(*opendir)(void *fs, int *touched);
+    struct dirent *(*readdir)(void *fs, void *dir);
+    long (*telldir)(void *fs, void *dir);
+    void (*seekdir)(void *fs, void *dir, long pos);
+    void (*rewinddir)(void *fs, void *dir);
+    int (*closedir)(void *fs, void *dir);
+    /* Make DIR the current directory */
+    int (*fchdir)(void *fs, void *dir);
+    int (*unlink)(void *fs, const char *name);
+    int (*rmdir)(void *fs, const char *name);
+    /* Set the atime and mtime of the current directory */
+    int (*utimens)(void *fs, const struct timespec times[2]);
+    /* Return nonzero if the absolute PATH is a destination of a bind mount */
+    int (*is_bind_mount)(void *fs, const char *path);
+};
+
+/* Make sweeps of TW and tmpwatch_add_rule() access the filesystem through
+   OPS with FS, instead of the POSIX functions; OPS == NULL restores them.
+   TMPWATCH_FUSER, TMPWATCH_SHRED, tmpwatch_set_pipeline(),
+   tmpwatch_set_truncate() and tmpwatch_set_quarantine() work on open files
+   of the real filesystem, and are not available with OPS;
+   tmpwatch_estimate() and tmpwatch_apply() always use the real filesystem.
+   Return 0 if OK, -1 with errno set (EINVAL if TW uses any of the above). */
+extern int tmpwatch_set_fs(struct tmpwatch *tw,
+			   const struct tmpwatch_fs_ops *ops, void *fs);
+
+/* Work done by the sweeps of a struct tmpwatch */
+struct tmpwatch_progress
+{
+    unsigned long dirs;		/* Directories entered */
+    unsigned long entries;	/* Entries read */
+    /* Entries removed (or that would be with TMPWATCH_TEST, or left to the
+       decide callback), and the size of those that are not directories */
+    unsigned long removed;
+    uintmax_t bytes;
+};
+
+/* Set *PROGRESS to the work done by the sweeps of TW so far, and PATH, of
+   PATH_SIZE bytes, to the directory being examined ("" between sweeps),
+   truncated if necessary.  May be called from another thread while TW is
+   sweeping. */
+extern void tmpwatch_progress(struct tmpwatch *tw,
+			      struct tmpwatch_progress *progress, char *path,
+			      size_t path_size);
+
+/* Stop the sweep of TW at the next directory entry.  Async-signal-safe. */
+extern void tmpwatch_stop(struct tmpwatch *tw);
+
+/* Return nonzero if the last sweep of TW was stopped */
+extern int tmpwatch_interrupted(const struct tmpwatch *tw);
+
+/* Set *LEVELS to the positions where the last, interrupted, sweep of TW
+   stopped, outermost directory first, and return their number.
+   Only available with TMPWATCH_CHECKPOINT. */
+extern size_t tmpwatch_frontier(const struct tmpwatch *tw,
+				const struct tmpwatch_position **levels);
+
+/* Make the next sweep of TW skip to LEVELS, outermost directory first,
+   as returned by tmpwatch_frontier(); directories that no longer match are
+   cleaned up from the start.  N == 0 cancels resuming.
+   Return 0 if OK, -1 with errno set. */
+extern int tmpwatch_resume(struct tmpwatch *tw,
+			   const struct tmpwatch_position *levels, size_t n);
+
+/* Remove entry NAME of directory DIR, the current directory, decided
+   earlier (with TMPWATCH_DEFER) for REASON, if it is still the inode DEV, INO
+   with the type of MODE and, unless it is a directory, its significant time
+   under FLAGS is still older than THRESHOLD.
+   Return 1 if NAME was removed (or would be with TMPWATCH_TEST), 0
+   otherwise. */
+extern int tmpwatch_apply(struct tmpwatch *tw, const char *dir,
+			  const char *name, dev_t dev, ino_t ino, mode_t mode,
+			  int flags, time_t threshold, int reason);
+
+#endif
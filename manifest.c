@@ -0,0 +1,196 @@
+/* manifest.c -- on-disk list of removal decisions
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "manifest.h"
+
+#define RECORD_ALIGN 8
+
+struct manifest
+{
+    FILE *f;
+    struct manifest_header header;
+};
+
+/* Write R followed by NAME to M.
+   Return 0 if OK, -1 with errno set. */
+static int
+write_record(struct manifest *m, struct manifest_record *r, const char *name)
+{
+    static const char padding[RECORD_ALIGN]; /* = { 0, }; */
+    size_t name_size, pad;
+
+    name_size = strlen(name) + 1;
+    pad = (RECORD_ALIGN - (sizeof(*r) + name_size) % RECORD_ALIGN)
+	% RECORD_ALIGN;
+    r->size = sizeof(*r) + name_size + pad;
+    if (fwrite(r, sizeof(*r), 1, m->f) != 1
+	|| fwrite(name, 1, name_size, m->f) != name_size
+	|| fwrite(padding, 1, pad, m->f) != pad)
+	return -1;
+    m->header.records++;
+    return 0;
+}
+
+struct manifest *
+manifest_create(const char *path, const struct manifest_header *header)
+{
+    struct manifest *m;
+
+    if ((m = malloc(sizeof(*m))) == NULL)
+	return NULL;
+    m->header = *header;
+    memcpy(m->header.magic, MANIFEST_MAGIC, sizeof(m->header.magic));
+    m->header.version = MANIFEST_VERSION;
+    m->header.records = 0;
+    if ((m->f = fopen(path, "w")) == NULL) {
+	free(m);
+	return NULL;
+    }
+    /* Rewritten with the final record count by manifest_close() */
+    if (fwrite(&m->header, sizeof(m->header), 1, m->f) != 1) {
+	fclose(m->f);
+	free(m);
+	return NULL;
+    }
+    return m;
+}
+
+long
+manifest_add_dir(struct manifest *m, const char *path, dev_t dev, ino_t ino)
+{
+    struct manifest_record r;
+    long index;
+
+    memset(&r, 0, sizeof(r));
+    r.type = MANIFEST_DIR;
+    r.mode = S_IFDIR;
+    r.dev = dev;
+    r.ino = ino;
+    index = m->header.records;
+    if (write_record(m, &r, path) != 0)
+	return -1;
+    return index;
+}
+
+int
+manifest_add_entry(struct manifest *m, long dir, const char *name, dev_t dev,
+		   ino_t ino, mode_t mode, int flags, time_t time,
+		   time_t threshold, int reason)
+{
+    struct manifest_record r;
+
+    memset(&r, 0, sizeof(r));
+    r.type = MANIFEST_ENTRY;
+    r.reason = reason;
+    r.dir = dir;
+    r.mode = mode;
+    r.flags = flags;
+    r.dev = dev;
+    r.ino = ino;
+    r.time = time;
+    r.threshold = threshold;
+    return write_record(m, &r, name);
+}
+
+int
+manifest_close(struct manifest *m)
+{
+    int ret;
+
+    ret = 0;
+    if (fseek(m->f, 0, SEEK_SET) != 0
+	|| fwrite(&m->header, sizeof(m->header), 1, m->f) != 1)
+	ret = -1;
+    if (fclose(m->f) != 0)
+	ret = -1;
+    free(m);
+    return ret;
+}
+
+int
+manifest_map(const char *path, struct manifest_map *map)
+{
+    struct stat sb;
+    int fd, saved_errno;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+	return -1;
+    if (fstat(fd, &sb) != 0)
+	goto error;
+    if ((size_t)sb.st_size < sizeof(*map->header)) {
+	errno = EINVAL;
+	goto error;
+    }
+    map->size = sb.st_size;
+    map->base = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map->base == MAP_FAILED)
+	goto error;
+    close(fd);
+    map->header = map->base;
+    if (memcmp(map->header->magic, MANIFEST_MAGIC,
+	       sizeof(map->header->magic)) != 0
+	|| map->header->version != MANIFEST_VERSION) {
+	manifest_unmap(map);
+	errno = EINVAL;
+	return -1;
+    }
+    return 0;
+
+error:
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+}
+
+const struct manifest_record *
+manifest_next(const struct manifest_map *map,
+	      const struct manifest_record *prev)
+{
+    const struct manifest_record *r;
+    size_t offset, left;
+
+    if (prev == NULL)
+	offset = sizeof(*map->header);
+    else
+	offset = (const char *)prev - (const char *)map->base + prev->size;
+    if (offset >= map->size)
+	return NULL;
+    left = map->size - offset;
+    r = (const struct manifest_record *)((const char *)map->base + offset);
+    if (left < sizeof(*r) || r->size < sizeof(*r) + 1 || r->size > left
+	|| r->size % RECORD_ALIGN != 0
+	|| memchr(r->name, 0, r->size - sizeof(*r)) == NULL)
+	return NULL;
+    return r;
+}
+
+void
+manifest_unmap(struct manifest_map *map)
+{
+    munmap(map->base, map->size);
+    map->base = NULL;
+    map->header = NULL;
+}
@@ -0,0 +1,104 @@
+/* manifest.h -- on-disk list of removal decisions
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef MANIFEST_H__
+#define MANIFEST_H__
+
+#include <config.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* A manifest is a header followed by variable-sized records, each aligned to
+   8 bytes so that the whole file can be used directly through mmap().
+   A MANIFEST_DIR record names a directory by its absolute path; the
+   MANIFEST_ENTRY records that follow it refer to it by its index and carry
+   only their own name. */
+
+#define MANIFEST_MAGIC "TMPWMAN\n"
+#define MANIFEST_VERSION 1
+
+struct manifest_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;		/* config_flags of the scan */
+    uint64_t records;		/* Number of records following the header */
+};
+
+/* Record types */
+#define MANIFEST_DIR	1
+#define MANIFEST_ENTRY	2
+
+struct manifest_record
+{
+    uint32_t size;		/* Including name and padding */
+    uint16_t type;
+    uint16_t reason;		/* TMPWATCH_REASON_*, unused for MANIFEST_DIR */
+    uint32_t dir;		/* Index of the parent MANIFEST_DIR record */
+    uint32_t mode;
+    uint32_t flags;		/* Time selection flags used for the entry */
+    uint32_t reserved;
+    uint64_t dev, ino;
+    /* The following are unused for MANIFEST_DIR */
+    int64_t time;		/* Significant time */
+    int64_t threshold;		/* The kill time TIME was older than */
+    char name[];		/* NUL-terminated, absolute for MANIFEST_DIR */
+};
+
+/* Writer state, opaque to callers */
+struct manifest;
+
+/* Create manifest PATH with HEADER (records is filled in on close).
+   Return writer state, or NULL with errno set. */
+extern struct manifest *manifest_create(const char *path,
+					const struct manifest_header *header);
+
+/* Add a directory PATH with identity DEV and INO.
+   Return its index for manifest_add_entry(), or -1 with errno set. */
+extern long manifest_add_dir(struct manifest *m, const char *path, dev_t dev,
+			     ino_t ino);
+
+/* Add an entry NAME in directory DIR, found to be older than THRESHOLD
+   using FLAGS.
+   Return 0 if OK, -1 with errno set. */
+extern int manifest_add_entry(struct manifest *m, long dir, const char *name,
+			      dev_t dev, ino_t ino, mode_t mode, int flags,
+			      time_t time, time_t threshold, int reason);
+
+/* Finish and close M.  Return 0 if OK, -1 with errno set. */
+extern int manifest_close(struct manifest *m);
+
+/* A manifest mapped for reading */
+struct manifest_map
+{
+    void *base;
+    size_t size;
+    const struct manifest_header *header;
+};
+
+/* Map manifest PATH into MAP and check its header.
+   Return 0 if OK, -1 with errno set. */
+extern int manifest_map(const char *path, struct manifest_map *map);
+
+/* Return the record following PREV (or the first record if PREV is NULL),
+   or NULL at the end of MAP or if the next record is malformed. */
+extern const struct manifest_record *
+manifest_next(const struct manifest_map *map,
+	      const struct manifest_record *prev);
+
+extern void manifest_unmap(struct manifest_map *map);
+
+#endif
@@ -0,0 +1,441 @@
+/* monitor.c -- progress reports while sweeping
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <config.h>
+
+#ifdef HAVE_PTHREAD_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "monitor.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Rates are computed over this many seconds */
+#define RATE_WINDOW 10
+
+/* How long to wait for the request of a client, in milliseconds */
+#define CLIENT_TIMEOUT 100
+
+/* The longest directory path reported; longer ones are truncated */
+#define REPORT_PATH_MAX 4096
+
+struct sample
+{
+    double when;		/* Seconds since the start of the monitor */
+    struct tmpwatch_progress progress;
+};
+
+static struct tmpwatch *monitor_tw;
+static pthread_t monitor_thread;
+static int monitor_running;	/* = 0; */
+/* The signal handler writes 'u' to request a report, monitor_stop() writes
+   'q' */
+static int wake_pipe[2];
+static int listen_fd = -1;
+static char *listen_path;	/* = NULL; */
+static struct sigaction old_usr1;
+
+/* Used only by the monitor thread */
+static double start_time;
+/* The last RATE_WINDOW + 1 samples taken once a second, oldest first */
+static struct sample samples[RATE_WINDOW + 1];
+static size_t num_samples;
+/* When the number of entries read last changed */
+static double last_change;
+static unsigned long last_entries;
+static char report_path[REPORT_PATH_MAX];
+static char report[6 * REPORT_PATH_MAX + 1024];
+
+/* Return a monotonic time in seconds */
+static double
+monitor_clock(void)
+{
+#if defined (HAVE_CLOCK_GETTIME) && defined (CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+usr1_handler(int sig)
+{
+    int saved_errno;
+
+    (void)sig;
+    saved_errno = errno;
+    (void)write(wake_pipe[1], "u", 1);
+    errno = saved_errno;
+}
+
+/* Read the progress of monitor_tw into SAMPLE, noting when it last changed */
+static void
+take_sample(struct sample *sample)
+{
+    sample->when = monitor_clock() - start_time;
+    tmpwatch_progress(monitor_tw, &sample->progress, report_path,
+		      sizeof(report_path));
+    if (sample->progress.entries != last_entries) {
+	last_entries = sample->progress.entries;
+	last_change = sample->when;
+    }
+}
+
+/* Append a sample to the window if a second has passed since the last one */
+static void
+update_samples(void)
+{
+    if (num_samples != 0
+	&& monitor_clock() - start_time - samples[num_samples - 1].when < 1)
+	return;
+    if (num_samples == RATE_WINDOW + 1) {
+	memmove(samples, samples + 1, RATE_WINDOW * sizeof(*samples));
+	num_samples--;
+    }
+    take_sample(samples + num_samples);
+    num_samples++;
+}
+
+/* Append PATH escaped as a JSON string to P, return the end of the result */
+static char *
+json_string(char *p, const char *path)
+{
+    *p++ = '"';
+    for (; *path != '\0'; path++) {
+	unsigned char c;
+
+	c = *path;
+	if (c == '"' || c == '\\') {
+	    *p++ = '\\';
+	    *p++ = c;
+	} else if (c < 0x20)
+	    p += sprintf(p, "\\u%04x", c);
+	else
+	    *p++ = c;
+    }
+    *p++ = '"';
+    *p = '\0';
+    return p;
+}
+
+/* Format the current progress as text, or as a JSON object if JSON, in
+   report[].  Return its length. */
+static size_t
+format_report(int json)
+{
+    struct sample now;
+    const struct sample *oldest;
+    double interval, entries_rate, removed_rate, bytes_rate;
+    char *p;
+
+    update_samples();
+    take_sample(&now);
+    oldest = samples;
+    interval = now.when - oldest->when;
+    if (interval > 0) {
+	entries_rate = (now.progress.entries - oldest->progress.entries)
+	    / interval;
+	removed_rate = (now.progress.removed - oldest->progress.removed)
+	    / interval;
+	bytes_rate = (now.progress.bytes - oldest->progress.bytes) / interval;
+    } else {
+	entries_rate = 0;
+	removed_rate = 0;
+	bytes_rate = 0;
+    }
+    p = report;
+    if (json) {
+	p += sprintf(p, "{\"path\": ");
+	p = json_string(p, report_path);
+	p += sprintf(p, ", \"elapsed\": %.1f, \"directories\": %lu, "
+		     "\"entries\": %lu, \"removed\": %lu, \"bytes\": %ju, "
+		     "\"entries_per_second\": %.1f, "
+		     "\"removals_per_second\": %.1f, "
+		     "\"bytes_per_second\": %.0f, \"rate_window\": %.1f, "
+		     "\"idle\": %.1f}\n", now.when, now.progress.dirs,
+		     now.progress.entries, now.progress.removed,
+		     now.progress.bytes, entries_rate, removed_rate,
+		     bytes_rate, interval, now.when - last_change);
+    } else
+	p += sprintf(p, "path: %s\n"
+		     "elapsed: %.1f s\n"
+		     "directories: %lu\n"
+		     "entries: %lu\n"
+		     "removed: %lu (%ju bytes)\n"
+		     "rate: %.1f entries/s, %.1f removals/s, %.0f bytes/s "
+		     "(last %.1f s)\n"
+		     "idle: %.1f s\n",
+		     *report_path != '\0' ? report_path : "-", now.when,
+		     now.progress.dirs, now.progress.entries,
+		     now.progress.removed, now.progress.bytes, entries_rate,
+		     removed_rate, bytes_rate, interval,
+		     now.when - last_change);
+    return p - report;
+}
+
+/* Answer a client connecting to listen_fd */
+static void
+serve_client(void)
+{
+    struct pollfd pfd;
+    char request[64];
+    ssize_t len;
+    size_t report_len;
+    int fd, json;
+
+    if ((fd = accept(listen_fd, NULL, NULL)) == -1)
+	return;
+    json = 0;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, CLIENT_TIMEOUT) == 1
+	&& (len = recv(fd, request, sizeof(request) - 1, MSG_DONTWAIT)) > 0) {
+	request[len] = '\0';
+	json = strncmp(request, "json", 4) == 0;
+    }
+    report_len = format_report(json);
+    /* Don't let a client that doesn't read stall the monitor */
+    (void)send(fd, report, report_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(fd);
+}
+
+static void *
+monitor_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+	struct pollfd pfds[2];
+	nfds_t nfds;
+
+	pfds[0].fd = wake_pipe[0];
+	pfds[0].events = POLLIN;
+	nfds = 1;
+	if (listen_fd != -1) {
+	    pfds[1].fd = listen_fd;
+	    pfds[1].events = POLLIN;
+	    nfds++;
+	}
+	if (poll(pfds, nfds, 1000) == -1) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	update_samples();
+	if (nfds > 1 && (pfds[1].revents & POLLIN) != 0)
+	    serve_client();
+	if ((pfds[0].revents & POLLIN) != 0) {
+	    char buf[16];
+	    ssize_t i, len;
+
+	    len = read(wake_pipe[0], buf, sizeof(buf));
+	    for (i = 0; i < len; i++) {
+		if (buf[i] == 'q')
+		    return NULL;
+	    }
+	    if (len > 0) {
+		size_t report_len;
+
+		report_len = format_report(0);
+		fwrite(report, 1, report_len, stderr);
+		fflush(stderr);
+	    }
+	}
+    }
+    return NULL;
+}
+
+/* Listen at PATH, replacing a socket nobody is listening at.
+   Return the socket, or -1 with errno set. */
+static int
+open_listener(const char *path)
+{
+    struct sockaddr_un sa;
+    mode_t old_umask;
+    int fd, err, retried;
+
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+	return -1;
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+    /* A client may be gone before it is accepted */
+    (void)fcntl(fd, F_SETFL, O_NONBLOCK);
+    retried = 0;
+    for (;;) {
+	struct stat st;
+	int probe;
+
+	old_umask = umask(077);
+	err = bind(fd, (struct sockaddr *)&sa, sizeof(sa));
+	umask(old_umask);
+	if (err == 0)
+	    break;
+	if (errno != EADDRINUSE || retried)
+	    goto err;
+	/* Only remove a socket left behind by a process that is gone */
+	if (lstat(path, &st) != 0 || !S_ISSOCK(st.st_mode))
+	    goto err;
+	if ((probe = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+	    goto err;
+	err = connect(probe, (struct sockaddr *)&sa, sizeof(sa));
+	close(probe);
+	if (err == 0 || errno != ECONNREFUSED) {
+	    errno = EADDRINUSE;
+	    goto err;
+	}
+	if (unlink(path) != 0)
+	    goto err;
+	retried = 1;
+    }
+    if (listen(fd, 8) != 0) {
+	err = errno;
+	unlink(path);
+	errno = err;
+	goto err;
+    }
+    return fd;
+
+ err:
+    err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+/* Remove the socket of a process that exits without monitor_stop(), e.g.
+   after a fatal error */
+static void
+remove_socket_at_exit(void)
+{
+    if (listen_fd != -1)
+	unlink(listen_path);
+}
+
+int
+monitor_start(struct tmpwatch *tw, const char *socket_path)
+{
+    static int registered;
+
+    struct sigaction sa;
+    sigset_t all, old;
+    int err;
+
+    monitor_tw = tw;
+    if (pipe(wake_pipe) != 0)
+	return -1;
+    (void)fcntl(wake_pipe[0], F_SETFD, FD_CLOEXEC);
+    (void)fcntl(wake_pipe[1], F_SETFD, FD_CLOEXEC);
+    /* A burst of signals must not block the sweep */
+    (void)fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+    if (socket_path != NULL) {
+	if ((listen_path = strdup(socket_path)) == NULL)
+	    goto err_pipe;
+	if ((listen_fd = open_listener(socket_path)) == -1)
+	    goto err_path;
+	if (!registered && atexit(remove_socket_at_exit) == 0)
+	    registered = 1;
+    }
+
+    start_time = monitor_clock();
+    num_samples = 0;
+    last_change = 0;
+    last_entries = 0;
+    update_samples();
+    last_entries = samples[0].progress.entries;
+
+    /* Signals are handled by the thread that walks the tree */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&monitor_thread, NULL, monitor_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+	errno = err;
+	goto err_socket;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = usr1_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, &old_usr1);
+    monitor_running = 1;
+    return 0;
+
+ err_socket:
+    if (listen_fd != -1) {
+	close(listen_fd);
+	listen_fd = -1;
+	unlink(listen_path);
+    }
+ err_path:
+    free(listen_path);
+    listen_path = NULL;
+ err_pipe:
+    err = errno;
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    errno = err;
+    return -1;
+}
+
+void
+monitor_stop(void)
+{
+    if (!monitor_running)
+	return;
+    sigaction(SIGUSR1, &old_usr1, NULL);
+    /* Blocking; the monitor reads everything written before this */
+    (void)fcntl(wake_pipe[1], F_SETFL, 0);
+    (void)write(wake_pipe[1], "q", 1);
+    pthread_join(monitor_thread, NULL);
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    if (listen_fd != -1) {
+	close(listen_fd);
+	listen_fd = -1;
+	unlink(listen_path);
+    }
+    free(listen_path);
+    listen_path = NULL;
+    monitor_running = 0;
+}
+
+#endif /* HAVE_PTHREAD_H */
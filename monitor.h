@@ -0,0 +1,52 @@
+/* monitor.h -- progress reports while sweeping
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef MONITOR_H__
+#define MONITOR_H__
+
+#include <config.h>
+
+#include <errno.h>
+
+#include "libtmpwatch.h"
+
+/* Use the same condition as in monitor.c! */
+#ifdef HAVE_PTHREAD_H
+
+/* Start a thread reporting the progress of TW: to stderr on SIGUSR1, and to
+   each client connecting to a Unix socket at SOCKET_PATH if it is not NULL.
+   A client receives a text report, or a JSON object if it first sends a line
+   starting with "json".
+   Return 0 if OK, -1 with errno set on error. */
+extern int monitor_start(struct tmpwatch *tw, const char *socket_path);
+
+/* Stop the thread started by monitor_start(), if any, and remove its
+   socket. */
+extern void monitor_stop(void);
+
+#else /* !HAVE_PTHREAD_H */
+
+static int monitor_start(struct tmpwatch *tw, const char *socket_path)
+{
+    (void)tw;
+    (void)socket_path;
+    errno = ENOSYS;
+    return -1;
+}
+
+#define monitor_stop() ((void)0)
+
+#endif /* HAVE_PTHREAD_H */
+
+#endif
@@ -0,0 +1,54 @@
+/* probes.h -- USDT probes for tracing sweeps
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef PROBES_H__
+#define PROBES_H__
+
+#include <config.h>
+
+/* Probes of provider "tmpwatch", built with --enable-usdt.  An untraced probe
+   is a single nop; the arguments are only computed into registers, so they
+   must stay cheap.  Paths and names are char *.
+
+   dir__enter(dir, dev, ino)	    cleanupDirectory() entered DIR
+   dir__exit(dir, left)		    ... leaving LEFT entries in DIR
+   entry__kept(dir, name, kept)	    NAME stays, for TMPWATCH_KEPT_* KEPT
+   entry__expired(dir, name, reason) NAME is to be removed, for
+				    TMPWATCH_REASON_* REASON
+   unlink__start(dir, name), unlink__done(dir, name, gone)
+   rmdir__start(dir, name), rmdir__done(dir, name, gone)
+   fuser__start(name), fuser__done(name, in_use)
+				    fuser run on a single file or directory
+   fuser__batch__start(name, n), fuser__batch__done(name, n, in_use)
+				    fuser run on N files starting with NAME,
+				    IN_USE if any of them is
+   bind__mounts__start(), bind__mounts__done(count)
+				    rebuild_bind_mount_paths() */
+
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+
+#define PROBE0(NAME) DTRACE_PROBE(tmpwatch, NAME)
+#define PROBE1(NAME, A) DTRACE_PROBE1(tmpwatch, NAME, A)
+#define PROBE2(NAME, A, B) DTRACE_PROBE2(tmpwatch, NAME, A, B)
+#define PROBE3(NAME, A, B, C) DTRACE_PROBE3(tmpwatch, NAME, A, B, C)
+#else
+/* Use the arguments, which are otherwise unused */
+#define PROBE0(NAME) ((void)0)
+#define PROBE1(NAME, A) ((void)(A))
+#define PROBE2(NAME, A, B) ((void)(A), (void)(B))
+#define PROBE3(NAME, A, B, C) ((void)(A), (void)(B), (void)(C))
+#endif
+
+#endif
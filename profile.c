@@ -0,0 +1,251 @@
+/* profile.c -- per-directory cost report
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+/* Names of TMPWATCH_KEPT_* in the report */
+static const char *const kept_names[TMPWATCH_KEPT_MAX] = {
+    "error", "device", "root-readonly", "lost+found", "excluded", "pattern",
+    "recent", "type", "uid", "special", "in-use", "not-empty", "nodirs",
+    "not-removed", "shard"
+};
+
+struct profile_dir
+{
+    char *path;
+    unsigned depth;
+    uint64_t self_time;		/* Not including subdirectories */
+    struct tmpwatch_dir_profile total; /* Including subdirectories */
+};
+
+struct profile
+{
+    struct profile_dir *dirs;
+    size_t num_dirs, dirs_allocated;
+    /* pending[DEPTH] is the total of the finished directories at DEPTH
+       whose parent is not finished yet */
+    struct tmpwatch_dir_profile *pending;
+    size_t pending_allocated;
+};
+
+/* Add the costs of B to A */
+static void
+add_costs(struct tmpwatch_dir_profile *a, const struct tmpwatch_dir_profile *b)
+{
+    size_t i;
+
+    a->entries += b->entries;
+    a->stats += b->stats;
+    a->time += b->time;
+    a->readdir_time += b->readdir_time;
+    a->stat_time += b->stat_time;
+    a->unlink_time += b->unlink_time;
+    a->rmdir_time += b->rmdir_time;
+    a->eligible_bytes += b->eligible_bytes;
+    a->removed_bytes += b->removed_bytes;
+    for (i = 0; i < TMPWATCH_KEPT_MAX; i++)
+	a->kept[i] += b->kept[i];
+}
+
+struct profile *
+profile_new(void)
+{
+    return calloc(1, sizeof(struct profile));
+}
+
+int
+profile_add(struct profile *p, const struct tmpwatch_dir_profile *d)
+{
+    struct profile_dir *dir;
+
+    if (p->num_dirs == p->dirs_allocated) {
+	struct profile_dir *dirs;
+	size_t allocated;
+
+	allocated = p->dirs_allocated == 0 ? 64 : 2 * p->dirs_allocated;
+	dirs = reallocarray(p->dirs, allocated, sizeof(*p->dirs));
+	if (dirs == NULL)
+	    return -1;
+	p->dirs = dirs;
+	p->dirs_allocated = allocated;
+    }
+    if (d->depth + 2 > p->pending_allocated) {
+	struct tmpwatch_dir_profile *pending;
+	size_t allocated;
+
+	allocated = 2 * (d->depth + 2);
+	pending = reallocarray(p->pending, allocated, sizeof(*p->pending));
+	if (pending == NULL)
+	    return -1;
+	memset(pending + p->pending_allocated, 0,
+	       (allocated - p->pending_allocated) * sizeof(*pending));
+	p->pending = pending;
+	p->pending_allocated = allocated;
+    }
+
+    dir = &p->dirs[p->num_dirs];
+    if ((dir->path = strdup(d->dir)) == NULL)
+	return -1;
+    dir->depth = d->depth;
+    dir->self_time = d->time;
+    dir->total = *d;
+    dir->total.dir = NULL;
+    /* All subdirectories of D are finished */
+    add_costs(&dir->total, &p->pending[d->depth + 1]);
+    memset(&p->pending[d->depth + 1], 0, sizeof(*p->pending));
+    add_costs(&p->pending[d->depth], &dir->total);
+    p->num_dirs++;
+    return 0;
+}
+
+/* Compare paths so that a directory sorts right before its contents */
+static int
+cmp_dirs(const void *xa, const void *xb)
+{
+    const unsigned char *a, *b;
+
+    a = (const unsigned char *)((const struct profile_dir *)xa)->path;
+    b = (const unsigned char *)((const struct profile_dir *)xb)->path;
+    while (*a != 0 && *a == *b) {
+	a++;
+	b++;
+    }
+    if (*a == *b)
+	return 0;
+    if (*a == '/')
+	return *b == 0 ? 1 : -1;
+    if (*b == '/')
+	return *a == 0 ? -1 : 1;
+    return *a < *b ? -1 : 1;
+}
+
+/* Write the report of P to F */
+static void
+write_report(const struct profile *p, FILE *f)
+{
+    size_t i, j;
+
+    fputs("# Times in milliseconds, sizes in bytes; all columns except self "
+	  "include\n"
+	  "# subdirectories\n"
+	  "#    total       self    readdir       stat     unlink      rmdir"
+	  "  entries    stats     eligible      removed  path  kept\n", f);
+    for (i = 0; i < p->num_dirs; i++) {
+	const struct profile_dir *d;
+
+	d = &p->dirs[i];
+	fprintf(f, "%10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %8lu %8lu %12ju "
+		"%12ju  %*s%s", d->total.time / 1e6, d->self_time / 1e6,
+		d->total.readdir_time / 1e6, d->total.stat_time / 1e6,
+		d->total.unlink_time / 1e6, d->total.rmdir_time / 1e6,
+		d->total.entries, d->total.stats, d->total.eligible_bytes,
+		d->total.removed_bytes, (int)(2 * d->depth), "", d->path);
+	for (j = 0; j < TMPWATCH_KEPT_MAX; j++) {
+	    if (d->total.kept[j] != 0)
+		fprintf(f, " %s=%lu", kept_names[j], d->total.kept[j]);
+	}
+	putc('\n', f);
+    }
+}
+
+/* Write the time spent in each directory of P to F as folded stacks: the
+   components of the path separated by ';', and the time in microseconds */
+static void
+write_folded(const struct profile *p, FILE *f)
+{
+    size_t i;
+
+    for (i = 0; i < p->num_dirs; i++) {
+	const struct profile_dir *d;
+	const char *s;
+	int first;
+
+	d = &p->dirs[i];
+	if (d->self_time / 1000 == 0)
+	    continue;
+	first = 1;
+	for (s = d->path; *s != 0; s++) {
+	    if (*s == '/') {
+		if (s[1] != 0 && s[1] != '/' && !first)
+		    putc(';', f);
+		continue;
+	    }
+	    first = 0;
+	    /* ';' separates frames, and the last ' ' the count */
+	    putc(*s == ';' ? '_' : *s, f);
+	}
+	if (first)
+	    putc('/', f);
+	fprintf(f, " %" PRIu64 "\n", d->self_time / 1000);
+    }
+}
+
+/* Write P to PATH using WRITER.
+   Return 0 if OK, -1 with errno set. */
+static int
+write_file(const struct profile *p, const char *path,
+	   void (*writer)(const struct profile *p, FILE *f))
+{
+    FILE *f;
+    int saved_errno;
+
+    if ((f = fopen(path, "w")) == NULL)
+	return -1;
+    writer(p, f);
+    if (ferror(f)) {
+	saved_errno = errno;
+	fclose(f);
+	errno = saved_errno;
+	return -1;
+    }
+    return fclose(f);
+}
+
+int
+profile_write(struct profile *p, const char *path)
+{
+    char *folded;
+    int ret;
+
+    qsort(p->dirs, p->num_dirs, sizeof(*p->dirs), cmp_dirs);
+    if (write_file(p, path, write_report) != 0)
+	return -1;
+    if ((folded = malloc(strlen(path) + sizeof(".folded"))) == NULL)
+	return -1;
+    strcpy(folded, path);
+    strcat(folded, ".folded");
+    ret = write_file(p, folded, write_folded);
+    free(folded);
+    return ret;
+}
+
+void
+profile_free(struct profile *p)
+{
+    size_t i;
+
+    for (i = 0; i < p->num_dirs; i++)
+	free(p->dirs[i].path);
+    free(p->dirs);
+    free(p->pending);
+    free(p);
+}
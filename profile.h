@@ -0,0 +1,42 @@
+/* profile.h -- per-directory cost report
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef PROFILE_H__
+#define PROFILE_H__
+
+#include <config.h>
+
+#include "libtmpwatch.h"
+
+/* Costs of the directories of one or more sweeps, opaque to callers */
+struct profile;
+
+/* Return an empty profile, or NULL with errno set. */
+extern struct profile *profile_new(void);
+
+/* Add the costs of directory D to P.  Directories must be added in the order
+   a sweep finishes them, i.e. each directory after its subdirectories, so
+   that the costs of subdirectories can be added to their parents.
+   Return 0 if OK, -1 with errno set. */
+extern int profile_add(struct profile *p, const struct tmpwatch_dir_profile *d);
+
+/* Write a report of P, sorted by path, to PATH, and the time spent in each
+   directory as folded stacks (the input format of flamegraph.pl) to
+   PATH.folded.
+   Return 0 if OK, -1 with errno set. */
+extern int profile_write(struct profile *p, const char *path);
+
+extern void profile_free(struct profile *p);
+
+#endif
@@ -0,0 +1,682 @@
+/* simfs.c -- a simulated filesystem for benchmarking sweeps
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <config.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "simfs.h"
+
+/* The device of all entries */
+#define SIMFS_DEV 0x53494d
+
+/* The inode number of the root, as on ext4 */
+#define ROOT_INO 2
+
+/* Limits of the settings, keeping the number of entries of a directory and
+   the times within 32 bits */
+#define MAX_COUNT (UINT32_C(1) << 30)
+
+#define NODE_DIR	(1 << 0)
+#define NODE_REMOVED	(1 << 1)
+#define NODE_LOADED	(1 << 2) /* The children were created */
+
+/* An entry, kept small: the tree may have many millions of them */
+struct node
+{
+    struct node *parent;	/* The root is its own parent */
+    struct node *children;	/* Subdirectories first; NULL until loaded, and
+				   after the directory is removed */
+    uint64_t ino;
+    uint32_t index;		/* The name is "d<index>" or "f<index>" */
+    uint32_t depth;		/* Below the root */
+    uint32_t atime, mtime, ctime;
+    union {
+	uint32_t size;		/* Of a file */
+	uint32_t live;		/* Entries of a directory not removed */
+    } u;
+    unsigned char flags;	/* NODE_* */
+};
+
+struct simfs
+{
+    uint64_t seed;
+    uint32_t depth, dirs, files, age, max_size;
+    time_t now;
+    uid_t uid;
+    gid_t gid;
+    uint64_t delay[SIMFS_OPS];	/* In nanoseconds */
+    struct node root;
+    struct node *cwd;
+    struct simfs_stats stats;
+};
+
+/* An open directory */
+struct simfs_dir
+{
+    struct node *node;
+    long pos;			/* 0 = ".", 1 = "..", 2 + N = child N */
+    struct dirent ent;
+};
+
+/* Return the next value of the generator with STATE (SplitMix64) */
+static uint64_t
+next_random(uint64_t *state)
+{
+    uint64_t z;
+
+    z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+/* Wait for the delay of OP in FS, and count OP */
+static void
+delay(struct simfs *fs, enum simfs_op op)
+{
+    uint64_t start, t;
+
+    fs->stats.ops[op]++;
+    if (fs->delay[op] == 0)
+	return;
+    /* Spin: sleeping can't be as short as a few microseconds */
+    start = 0;
+    do {
+#if defined (HAVE_CLOCK_GETTIME) && defined (CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	t = (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+	if (start == 0)
+	    start = t;
+    } while (t - start < fs->delay[op]);
+}
+
+/* Return the number of subdirectories of directory NODE in FS */
+static uint32_t
+num_dirs(const struct simfs *fs, const struct node *node)
+{
+    return node->depth < fs->depth ? fs->dirs : 0;
+}
+
+/* Make NODE entry INDEX of PARENT in FS, a directory if IS_DIR, with times
+   and size from the generator with STATE */
+static void
+init_node(struct simfs *fs, struct node *node, struct node *parent,
+	  uint32_t index, int is_dir, uint64_t *state)
+{
+    uint64_t id;
+
+    node->parent = parent;
+    node->children = NULL;
+    /* Unique in practice, and the same in every run */
+    id = parent->ino * UINT64_C(0x100000001b3)
+	^ ((uint64_t)index << 1 | is_dir);
+    node->ino = next_random(&id) | 1;
+    node->index = index;
+    node->depth = parent == node ? 0 : parent->depth + 1;
+    node->mtime = fs->now - next_random(state) % (fs->age + 1);
+    node->atime = node->mtime + next_random(state) % (fs->now - node->mtime
+							+ 1);
+    node->ctime = node->mtime;
+    if (is_dir) {
+	node->flags = NODE_DIR;
+	node->u.live = num_dirs(fs, node) + fs->files;
+	fs->stats.dirs++;
+    } else {
+	node->flags = 0;
+	node->u.size = next_random(state) % ((uint64_t)fs->max_size + 1);
+	fs->stats.files++;
+    }
+}
+
+/* Create the children of directory DIR in FS, if not done yet.
+   Return 0 if OK, -1 with errno set. */
+static int
+load(struct simfs *fs, struct node *dir)
+{
+    uint64_t state;
+    uint32_t i, n, dirs;
+
+    if ((dir->flags & NODE_LOADED) != 0)
+	return 0;
+    dirs = num_dirs(fs, dir);
+    n = dirs + fs->files;
+    if (n != 0 && (dir->children = calloc(n, sizeof(*dir->children))) == NULL)
+	return -1;
+    /* The same seed gives the same contents, in whatever order the
+       directories are loaded */
+    state = fs->seed ^ dir->ino;
+    for (i = 0; i < n; i++)
+	init_node(fs, &dir->children[i], dir, i < dirs ? i : i - dirs,
+		  i < dirs, &state);
+    dir->flags |= NODE_LOADED;
+    return 0;
+}
+
+/* Return the child of directory DIR in FS named by the LEN bytes at NAME,
+   or NULL with errno set */
+static struct node *
+lookup_child(struct simfs *fs, struct node *dir, const char *name, size_t len)
+{
+    uint32_t index, dirs, slot;
+    size_t i;
+
+    if (load(fs, dir) != 0)
+	return NULL;
+    errno = ENOENT;
+    if (len < 2 || len > 11 || (name[0] != 'd' && name[0] != 'f')
+	|| (name[1] == '0' && len > 2))
+	return NULL;
+    index = 0;
+    for (i = 1; i < len; i++) {
+	if (!isdigit((unsigned char)name[i]))
+	    return NULL;
+	if (index > (UINT32_MAX - 9) / 10)
+	    return NULL;
+	index = index * 10 + (name[i] - '0');
+    }
+    dirs = num_dirs(fs, dir);
+    if (name[0] == 'd') {
+	if (index >= dirs)
+	    return NULL;
+	slot = index;
+    } else {
+	if (index >= fs->files)
+	    return NULL;
+	slot = dirs + index;
+    }
+    if (dir->children == NULL || (dir->children[slot].flags & NODE_REMOVED))
+	return NULL;
+    return &dir->children[slot];
+}
+
+/* Set *RESULT to the entry at PATH in FS.
+   Return 0 if OK, -1 with errno set. */
+static int
+lookup(struct simfs *fs, const char *path, struct node **result)
+{
+    struct node *node;
+    const char *p, *end;
+
+    node = *path == '/' ? &fs->root : fs->cwd;
+    for (p = path; *p != 0; p = end) {
+	size_t len;
+
+	while (*p == '/')
+	    p++;
+	if (*p == 0)
+	    break;
+	for (end = p; *end != 0 && *end != '/'; end++)
+	    ;
+	len = end - p;
+	if ((node->flags & NODE_DIR) == 0) {
+	    errno = ENOTDIR;
+	    return -1;
+	}
+	if (len == 1 && p[0] == '.')
+	    continue;
+	if (len == 2 && p[0] == '.' && p[1] == '.')
+	    node = node->parent;
+	else if ((node = lookup_child(fs, node, p, len)) == NULL)
+	    return -1;
+    }
+    *result = node;
+    return 0;
+}
+
+/* Describe NODE of FS in SB */
+static void
+fill_stat(const struct simfs *fs, const struct node *node, struct stat *sb)
+{
+    memset(sb, 0, sizeof(*sb));
+    sb->st_dev = SIMFS_DEV;
+    sb->st_ino = node->ino;
+    sb->st_uid = fs->uid;
+    sb->st_gid = fs->gid;
+    if ((node->flags & NODE_DIR) != 0) {
+	sb->st_mode = S_IFDIR | 0755;
+	sb->st_nlink = 2;
+	sb->st_size = 4096;
+    } else {
+	sb->st_mode = S_IFREG | 0644;
+	sb->st_nlink = 1;
+	sb->st_size = node->u.size;
+    }
+    if ((node->flags & NODE_REMOVED) != 0)
+	sb->st_nlink = 0;
+    sb->st_blksize = 4096;
+    sb->st_blocks = (sb->st_size + 511) / 512;
+    sb->st_atime = node->atime;
+    sb->st_mtime = node->mtime;
+    sb->st_ctime = node->ctime;
+}
+
+/* Mark NODE of FS removed */
+static void
+remove_node(struct simfs *fs, struct node *node)
+{
+    node->flags |= NODE_REMOVED;
+    node->parent->u.live--;
+    node->parent->mtime = time(NULL);
+    node->parent->ctime = node->parent->mtime;
+    fs->stats.removed++;
+}
+
+static int
+simfs_lstat(void *data, const char *path, struct stat *sb)
+{
+    struct simfs *fs;
+    struct node *node;
+
+    fs = data;
+    delay(fs, SIMFS_LSTAT);
+    if (lookup(fs, path, &node) != 0)
+	return -1;
+    fill_stat(fs, node, sb);
+    return 0;
+}
+
+static int
+simfs_chdir(void *data, const char *path)
+{
+    struct simfs *fs;
+    struct node *node;
+
+    fs = data;
+    delay(fs, SIMFS_CHDIR);
+    if (lookup(fs, path, &node) != 0)
+	return -1;
+    if ((node->flags & NODE_DIR) == 0) {
+	errno = ENOTDIR;
+	return -1;
+    }
+    fs->cwd = node;
+    return 0;
+}
+
+/* Atimes are not updated by reading, so *TOUCHED is left alone */
+static void *
+simfs_opendir(void *data, int *touched)
+{
+    struct simfs *fs;
+    struct simfs_dir *dir;
+
+    (void)touched;
+    fs = data;
+    delay(fs, SIMFS_OPENDIR);
+    if (load(fs, fs->cwd) != 0 || (dir = malloc(sizeof(*dir))) == NULL)
+	return NULL;
+    dir->node = fs->cwd;
+    dir->pos = 0;
+    return dir;
+}
+
+static struct dirent *
+simfs_readdir(void *data, void *dir_)
+{
+    struct simfs *fs;
+    struct simfs_dir *dir;
+    const struct node *node;
+    uint32_t n;
+
+    fs = data;
+    dir = dir_;
+    n = num_dirs(fs, dir->node) + fs->files;
+    for (;;) {
+	if (dir->pos < 2)
+	    node = dir->pos == 0 ? dir->node : dir->node->parent;
+	else if (dir->node->children == NULL || dir->pos - 2 >= n)
+	    return NULL;
+	else {
+	    node = &dir->node->children[dir->pos - 2];
+	    if ((node->flags & NODE_REMOVED) != 0) {
+		dir->pos++;
+		continue;
+	    }
+	}
+	break;
+    }
+    delay(fs, SIMFS_READDIR);
+    memset(&dir->ent, 0, sizeof(dir->ent));
+    dir->ent.d_ino = node->ino;
+#ifdef _DIRENT_HAVE_D_TYPE
+    dir->ent.d_type = (node->flags & NODE_DIR) != 0 ? DT_DIR : DT_REG;
+#endif
+    if (dir->pos < 2)
+	strcpy(dir->ent.d_name, dir->pos == 0 ? "." : "..");
+    else
+	snprintf(dir->ent.d_name, sizeof(dir->ent.d_name), "%c%" PRIu32,
+		 (node->flags & NODE_DIR) != 0 ? 'd' : 'f', node->index);
+    dir->pos++;
+    return &dir->ent;
+}
+
+static long
+simfs_telldir(void *data, void *dir)
+{
+    (void)data;
+    return ((struct simfs_dir *)dir)->pos;
+}
+
+static void
+simfs_seekdir(void *data, void *dir, long pos)
+{
+    (void)data;
+    ((struct simfs_dir *)dir)->pos = pos;
+}
+
+static void
+simfs_rewinddir(void *data, void *dir)
+{
+    (void)data;
+    ((struct simfs_dir *)dir)->pos = 0;
+}
+
+static int
+simfs_closedir(void *data, void *dir)
+{
+    delay(data, SIMFS_CLOSEDIR);
+    free(dir);
+    return 0;
+}
+
+static int
+simfs_fchdir(void *data, void *dir)
+{
+    struct simfs *fs;
+
+    fs = data;
+    fs->cwd = ((struct simfs_dir *)dir)->node;
+    return 0;
+}
+
+static int
+simfs_unlink(void *data, const char *name)
+{
+    struct simfs *fs;
+    struct node *node;
+
+    fs = data;
+    delay(fs, SIMFS_UNLINK);
+    if (lookup(fs, name, &node) != 0)
+	return -1;
+    if ((node->flags & NODE_DIR) != 0) {
+	errno = EISDIR;
+	return -1;
+    }
+    remove_node(fs, node);
+    return 0;
+}
+
+static int
+simfs_rmdir(void *data, const char *name)
+{
+    struct simfs *fs;
+    struct node *node;
+
+    fs = data;
+    delay(fs, SIMFS_RMDIR);
+    if (lookup(fs, name, &node) != 0)
+	return -1;
+    if ((node->flags & NODE_DIR) == 0) {
+	errno = ENOTDIR;
+	return -1;
+    }
+    if (node == &fs->root) {
+	errno = EBUSY;
+	return -1;
+    }
+    if (node->u.live != 0) {
+	errno = ENOTEMPTY;
+	return -1;
+    }
+    /* Its children are all removed, and so are their children */
+    free(node->children);
+    node->children = NULL;
+    node->flags |= NODE_LOADED;
+    remove_node(fs, node);
+    return 0;
+}
+
+static int
+simfs_utimens(void *data, const struct timespec times[2])
+{
+    struct simfs *fs;
+
+    fs = data;
+    delay(fs, SIMFS_UTIMENS);
+    fs->cwd->atime = times[0].tv_sec;
+    fs->cwd->mtime = times[1].tv_sec;
+    return 0;
+}
+
+/* There are no mounts */
+static int
+simfs_is_bind_mount(void *data, const char *path)
+{
+    (void)data;
+    (void)path;
+    return 0;
+}
+
+const struct tmpwatch_fs_ops simfs_ops = {
+    simfs_lstat, simfs_chdir, simfs_opendir, simfs_readdir, simfs_telldir,
+    simfs_seekdir, simfs_rewinddir, simfs_closedir, simfs_fchdir,
+    simfs_unlink, simfs_rmdir, simfs_utimens, simfs_is_bind_mount
+};
+
+/* A suffix of a number, multiplying it by SCALE */
+struct unit
+{
+    const char *suffix;
+    uint64_t scale;
+};
+
+/* Without a suffix, hours as in the time argument of tmpwatch */
+static const struct unit time_units[] = {
+    { "", 3600 }, { "m", 60 }, { "h", 3600 }, { "d", 86400 }, { NULL, 0 }
+};
+
+static const struct unit delay_units[] = {
+    { "", 1 }, { "ns", 1 }, { "us", 1000 }, { "ms", 1000000 }, { NULL, 0 }
+};
+
+static const struct unit no_units[] = {
+    { "", 1 }, { NULL, 0 }
+};
+
+/* Names of the operations in a specification, by enum simfs_op */
+static const char *const op_names[SIMFS_OPS] = {
+    "lstat", "chdir", "opendir", "readdir", "closedir", "unlink", "rmdir",
+    "utimens"
+};
+
+/* Parse S, a number with one of UNITS, into *RESULT, at most MAX.
+   Return 0 if OK, -1 if S is invalid. */
+static int
+parse_value(const char *s, const struct unit *units, uint64_t max,
+	    uint64_t *result)
+{
+    unsigned long long v;
+    char *end;
+
+    if (!isdigit((unsigned char)*s))
+	return -1;
+    errno = 0;
+    v = strtoull(s, &end, 10);
+    if (errno != 0)
+	return -1;
+    for (; units->suffix != NULL; units++) {
+	if (strcmp(end, units->suffix) == 0) {
+	    if (v > max / units->scale)
+		return -1;
+	    *result = v * units->scale;
+	    return 0;
+	}
+    }
+    return -1;
+}
+
+/* Apply KEY=VALUE to FS.
+   Return NULL if OK, a message if it is invalid. */
+static const char *
+parse_setting(struct simfs *fs, const char *key, const char *value)
+{
+    uint64_t v;
+    size_t i;
+
+    if (strcmp(key, "seed") == 0) {
+	if (parse_value(value, no_units, UINT64_MAX, &fs->seed) != 0)
+	    return "bad seed";
+    } else if (strcmp(key, "depth") == 0) {
+	if (parse_value(value, no_units, MAX_COUNT, &v) != 0)
+	    return "bad depth";
+	fs->depth = v;
+    } else if (strcmp(key, "dirs") == 0) {
+	if (parse_value(value, no_units, MAX_COUNT, &v) != 0)
+	    return "bad number of directories";
+	fs->dirs = v;
+    } else if (strcmp(key, "files") == 0) {
+	if (parse_value(value, no_units, MAX_COUNT, &v) != 0)
+	    return "bad number of files";
+	fs->files = v;
+    } else if (strcmp(key, "age") == 0) {
+	if (parse_value(value, time_units, fs->now, &v) != 0)
+	    return "bad age";
+	fs->age = v;
+    } else if (strcmp(key, "size") == 0) {
+	if (parse_value(value, no_units, UINT32_MAX, &v) != 0)
+	    return "bad size";
+	fs->max_size = v;
+    } else {
+	for (i = 0; i < SIMFS_OPS; i++) {
+	    if (strcmp(key, op_names[i]) == 0)
+		break;
+	}
+	if (i == SIMFS_OPS)
+	    return "unknown setting";
+	if (parse_value(value, delay_units, UINT64_MAX, &fs->delay[i]) != 0)
+	    return "bad delay";
+    }
+    return NULL;
+}
+
+struct simfs *
+simfs_new(const char *spec, time_t now, const char **error)
+{
+    struct simfs *fs;
+    char *copy, *setting, *save;
+    uint64_t state;
+
+    *error = NULL;
+    /* The times are kept in 32 bits */
+    if (now < 0 || (uint64_t)now > UINT32_MAX) {
+	*error = "the current time is out of range";
+	return NULL;
+    }
+    if ((fs = calloc(1, sizeof(*fs))) == NULL)
+	return NULL;
+    fs->seed = 1;
+    fs->depth = 3;
+    fs->dirs = 4;
+    fs->files = 100;
+    fs->age = 30 * 86400;
+    fs->max_size = 65536;
+    fs->now = now;
+    fs->uid = getuid();
+    fs->gid = getgid();
+
+    if ((copy = strdup(spec)) == NULL) {
+	free(fs);
+	return NULL;
+    }
+    for (setting = strtok_r(copy, ",", &save); setting != NULL;
+	 setting = strtok_r(NULL, ",", &save)) {
+	char *value;
+
+	if ((value = strchr(setting, '=')) == NULL)
+	    *error = "KEY=VALUE expected";
+	else {
+	    *value++ = 0;
+	    *error = parse_setting(fs, setting, value);
+	}
+	if (*error != NULL) {
+	    free(copy);
+	    free(fs);
+	    return NULL;
+	}
+    }
+    free(copy);
+
+    fs->root.ino = ROOT_INO;
+    state = fs->seed ^ ROOT_INO;
+    init_node(fs, &fs->root, &fs->root, 0, 1, &state);
+    fs->root.ino = ROOT_INO;
+    fs->cwd = &fs->root;
+    return fs;
+}
+
+void
+simfs_stats(const struct simfs *fs, struct simfs_stats *stats)
+{
+    *stats = fs->stats;
+}
+
+void
+simfs_free(struct simfs *fs)
+{
+    struct node *node;
+
+    /* Bottom-up without recursion: the tree may be deep */
+    node = &fs->root;
+    while (node != NULL) {
+	struct node *child;
+	uint32_t i, dirs;
+
+	child = NULL;
+	if (node->children != NULL) {
+	    dirs = num_dirs(fs, node);
+	    for (i = 0; i < dirs && child == NULL; i++) {
+		if (node->children[i].children != NULL)
+		    child = &node->children[i];
+	    }
+	}
+	if (child != NULL) {
+	    node = child;
+	    continue;
+	}
+	free(node->children);
+	node->children = NULL;
+	node = node == &fs->root ? NULL : node->parent;
+    }
+    free(fs);
+}
@@ -0,0 +1,75 @@
+/* simfs.h -- a simulated filesystem for benchmarking sweeps
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef SIMFS_H__
+#define SIMFS_H__
+
+#include <config.h>
+
+#include "libtmpwatch.h"
+
+/* A directory tree kept in memory, generated from a seed.  The contents of
+   each directory are created the first time it is read, so only the parts
+   of the tree that a sweep reaches use memory. */
+struct simfs;
+
+/* Operations counted and delayed by a struct simfs */
+enum simfs_op
+{
+    SIMFS_LSTAT,
+    SIMFS_CHDIR,
+    SIMFS_OPENDIR,
+    SIMFS_READDIR,		/* For each entry */
+    SIMFS_CLOSEDIR,
+    SIMFS_UNLINK,
+    SIMFS_RMDIR,
+    SIMFS_UTIMENS,
+    SIMFS_OPS
+};
+
+struct simfs_stats
+{
+    unsigned long dirs, files;	/* Created so far, including the root */
+    unsigned long removed;
+    unsigned long ops[SIMFS_OPS];
+};
+
+/* Operations on a struct simfs, for tmpwatch_set_fs() */
+extern const struct tmpwatch_fs_ops simfs_ops;
+
+/* Return a simulated tree described by SPEC, a comma-separated list of
+   KEY=VALUE settings:
+	seed=N		of the generator (1)
+	depth=N		levels of directories below "/" (3)
+	dirs=N		subdirectories of each directory above the last
+			level (4)
+	files=N		files in each directory (100)
+	age=TIME	times are spread over TIME before NOW, in the format
+			of the time argument of tmpwatch (30d)
+	size=N		largest file size in bytes (65536)
+	OP=DELAY	delay each lstat, chdir, opendir, readdir (for each
+			entry), closedir, unlink, rmdir or utimens by DELAY,
+			with an ns, us or ms suffix (0)
+   Entries are named "d<n>" and "f<n>", and owned by the caller.
+   Return NULL with *ERROR set to a message if SPEC is invalid, or with
+   *ERROR set to NULL on memory allocation failure. */
+extern struct simfs *simfs_new(const char *spec, time_t now,
+			       const char **error);
+
+/* Return the statistics of FS so far in *STATS */
+extern void simfs_stats(const struct simfs *fs, struct simfs_stats *stats);
+
+extern void simfs_free(struct simfs *fs);
+
+#endif
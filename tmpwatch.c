@@ -24,35 +24,32 @@
  */
 #include <config.h>
 
-#include <assert.h>
-#include <dirent.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <fnmatch.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <sys/stat.h>
-#include <sys/time.h>
 #include <sys/types.h>
-#include <sys/wait.h>
-#include <utime.h>
 #include <unistd.h>
 
-#ifdef HAVE_MNTENT_H
-#include <mntent.h>
-#endif
-#ifdef HAVE_PATHS_H
-#include <paths.h>
-#endif
+#include "libtmpwatch.h"
+#include "manifest.h"
+#include "monitor.h"
+#include "profile.h"
+#include "simfs.h"
 
-#include "bind-mount.h"
+/* --fuser uses file leases, and fuser where they are not supported */
+#if defined FUSER || defined F_SETLEASE
+#define HAVE_FUSER_OPTION 1
+#endif
 
 #ifdef __GNUC__
 #define attribute__(X) __attribute__ (X)
@@ -60,68 +57,52 @@
 #define attribute__(X)
 #endif
 
-#define LOG_REALDEBUG	1
-#define LOG_DEBUG	2
-#define LOG_VERBOSE	3
-#define LOG_NORMAL	4
-#define LOG_ERROR	5
-#define LOG_FATAL	6
-
-#define FLAG_FORCE	(1 << 0)
-/* normally just files, dirs, and sockets older than (boot time - grace period)
-   are removed */
-#define FLAG_ALLFILES	(1 << 1)
-#define FLAG_TEST	(1 << 2)
-#define FLAG_ATIME	(1 << 3)
-#define FLAG_MTIME	(1 << 4)
-#define FLAG_FUSER	(1 << 5)
-#define FLAG_CTIME	(1 << 6)
-#define FLAG_NODIRS	(1 << 7)
-#define FLAG_NOSYMLINKS (1 << 8)
-#define FLAG_DIRMTIME	(1 << 9)
-#define FLAG_SHRED	(1 <<10)
-
-/* Do not remove lost+found directories if owned by this UID */
-#define LOSTFOUND_UID 0
-
-struct exclusion
-{
-    struct exclusion *next;
-    const char *dir, *file;
-};
+#define LOG_REALDEBUG	TMPWATCH_LOG_REALDEBUG
+#define LOG_DEBUG	TMPWATCH_LOG_DEBUG
+#define LOG_VERBOSE	TMPWATCH_LOG_VERBOSE
+#define LOG_NORMAL	TMPWATCH_LOG_NORMAL
+#define LOG_ERROR	TMPWATCH_LOG_ERROR
+#define LOG_FATAL	TMPWATCH_LOG_FATAL
 
-static struct exclusion *exclusions /* = NULL */;
-static struct exclusion **exclusions_tail = &exclusions;
-
-struct excluded_pattern
+/* A command-line exclusion, applied to all policies */
+struct cli_exclusion
 {
-    struct excluded_pattern *next;
-    char *pattern;
+    struct cli_exclusion *next;
+    int option;			/* 'x', 'X' or 'U' */
+    const char *arg;
+    uid_t uid;			/* For 'U' */
 };
 
-static struct excluded_pattern *excluded_patterns; /* = NULL; */
-static struct excluded_pattern **excluded_patterns_tail = &excluded_patterns;
+static struct cli_exclusion *cli_exclusions /* = NULL */;
+static struct cli_exclusion **cli_exclusions_tail = &cli_exclusions;
 
-struct excluded_uid
-{
-    struct excluded_uid *next;
-    uid_t uid;
-};
+/* Rules from --config, sorted by root */
+static struct tmpwatch_policy **policies /* = NULL */;
+static size_t num_policies; /* = 0; */
 
-static struct excluded_uid *excluded_uids /* = NULL */;
-static struct excluded_uid **excluded_uids_tail = &excluded_uids;
+static int config_flags; /* = 0; */
 
-static time_t kill_time;
-static time_t socket_kill_time; /* 0 = never */
+static struct tmpwatch *tw;
 
-static int config_flags; /* = 0; */
+/* Output of --scan-to, or NULL */
+static struct manifest *scan_manifest /* = NULL */;
+
+/* Costs collected for --profile, or NULL */
+static struct profile *profile /* = NULL */;
+
+/* The tree of --simulate, or NULL */
+static struct simfs *simfs /* = NULL */;
+
+/* --checkpoint file, or NULL */
+static const char *checkpoint_file /* = NULL */;
+/* The root to resume from */
+static char *resume_root /* = NULL */;
 
 static int logLevel = LOG_NORMAL;
 
-static void attribute__((format(printf, 2, 3)))
-  message(int level, const char *format, ...)
+static void
+vmessage(int level, const char *format, va_list args)
 {
-    va_list args;
     FILE * where = stdout;
 
     if (level >= logLevel) {
@@ -130,14 +111,30 @@ static void attribute__((format(printf, 2, 3)))
 	    fprintf(where, "error: ");
 	}
 
-	va_start(args, format);
 	vfprintf(where, format, args);
-	va_end(args);
 
 	if (level == LOG_FATAL) exit(1);
     }
 }
 
+static void attribute__((format(printf, 2, 3)))
+  message(int level, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vmessage(level, format, args);
+    va_end(args);
+}
+
+/* Log callback of tw */
+static void
+log_message(void *data, int level, const char *format, va_list args)
+{
+    (void)data;
+    vmessage(level, format, args);
+}
+
 static char *
 absolute_path(const char *path, int allow_nonexistent)
 {
@@ -155,596 +152,859 @@ absolute_path(const char *path, int allow_nonexistent)
     return strdup(src);
 }
 
-/* Returns 0 if OK, 2 on ENOENT, 1 on other errors */
+/* Decide callback of tw for --scan-to: add ENTRY to scan_manifest instead of
+   removing it */
 static int
-safe_chdir(const char *fulldirname, const char *reldirname, dev_t st_dev,
-	   ino_t st_ino)
+record_decision(void *data, const struct tmpwatch_entry *entry)
 {
-    struct stat sb1, sb2;
-
-    if (lstat(reldirname, &sb1)) {
-	if (errno == ENOENT)
-	    return 2;
-	message(LOG_ERROR, "lstat() of directory %s failed: %s\n",
-		fulldirname, strerror(errno));
-	return 1;
+    (void)data;
+    /* *entry->dir_data is the index of the directory in scan_manifest */
+    if (*entry->dir_data == -1) {
+	*entry->dir_data = manifest_add_dir(scan_manifest, entry->dir,
+					    entry->dir_stat->st_dev,
+					    entry->dir_stat->st_ino);
+	if (*entry->dir_data == -1)
+	    message(LOG_FATAL, "error writing manifest: %s\n",
+		    strerror(errno));
     }
+    if (manifest_add_entry(scan_manifest, *entry->dir_data, entry->name,
+			   entry->stat->st_dev, entry->stat->st_ino,
+			   entry->stat->st_mode,
+			   entry->flags & TMPWATCH_TIME_FLAGS, entry->time,
+			   entry->threshold, entry->reason) != 0)
+	message(LOG_FATAL, "error writing manifest: %s\n", strerror(errno));
+    return TMPWATCH_DEFER;
+}
 
-    if (! S_ISDIR(sb1.st_mode)) {
-	message(LOG_ERROR, "directory %s changed right under us!!!\n",
-		fulldirname);
-	message(LOG_FATAL, "this indicates a possible intrusion attempt\n");
-	return 1;
-    }
+/* Profile callback of tw for --profile */
+static void
+record_profile(void *data, const struct tmpwatch_dir_profile *d)
+{
+    (void)data;
+    if (profile_add(profile, d) != 0)
+	message(LOG_FATAL, "error allocating memory\n");
+}
+
+/* Signal handler for --deadline and --checkpoint */
+static void
+stop_handler(int sig)
+{
+    (void)sig;
+    tmpwatch_stop(tw);
+}
 
-    /* Check if the directory changed between cleanupDirectory and
-     * safe_chdir
-     */
-    if (st_dev != sb1.st_dev || st_ino != sb1.st_ino) {
-	message(LOG_ERROR, "directory %s changed right under us!!!\n",
-		fulldirname);
-	message(LOG_FATAL, "this indicates a possible intrusion attempt\n");
-	return 1;
+/* Write S to F, escaping '\\' and '\n' in the octal form used by
+   /proc/self/mountinfo */
+static void
+write_escaped(FILE *f, const char *s)
+{
+    for (; *s != 0; s++) {
+	if (*s == '\\' || *s == '\n')
+	    fprintf(f, "\\%03o", (unsigned char)*s);
+	else
+	    putc(*s, f);
     }
+}
 
-    if (chdir(reldirname) != 0) {
-	if (errno == ENOENT)
-	    return 2;
-	message(LOG_ERROR, "chdir to directory %s failed: %s\n",
-		fulldirname, strerror(errno));
-	return 1;
+/* Undo write_escaped() on S in place */
+static void
+unescape(char *s)
+{
+    char *dest;
+
+    for (dest = s; *s != 0; s++) {
+	if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3'
+	    && s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7') {
+	    *dest++ = ((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0');
+	    s += 3;
+	} else
+	    *dest++ = *s;
     }
+    *dest = 0;
+}
+
+#define CHECKPOINT_HEADER "tmpwatch checkpoint 1\n"
 
-    if (lstat(".", &sb2) != 0) {
-	message(LOG_ERROR, "second lstat() of directory %s failed: %s\n",
-		fulldirname, strerror(errno));
-	return 1;
+/* Save the frontier of the interrupted sweep of ROOT to checkpoint_file */
+static void
+write_checkpoint(const char *root)
+{
+    const struct tmpwatch_position *levels;
+    size_t num_levels, i;
+    char *tmp;
+    FILE *f;
+
+    if ((tmp = malloc(strlen(checkpoint_file) + 5)) == NULL)
+	message(LOG_FATAL, "error allocating memory\n");
+    strcpy(stpcpy(tmp, checkpoint_file), ".tmp");
+    if ((f = fopen(tmp, "w")) == NULL)
+	message(LOG_FATAL, "cannot create %s: %s\n", tmp, strerror(errno));
+    fputs(CHECKPOINT_HEADER, f);
+    fputs("root ", f);
+    write_escaped(f, root);
+    putc('\n', f);
+    num_levels = tmpwatch_frontier(tw, &levels);
+    for (i = 0; i < num_levels; i++) {
+	fprintf(f, "level %ju %ju %ld ", (uintmax_t)levels[i].dev,
+		(uintmax_t)levels[i].ino, levels[i].pos);
+	write_escaped(f, levels[i].name);
+	putc('\n', f);
     }
+    if (ferror(f) || fclose(f) != 0 || rename(tmp, checkpoint_file) != 0)
+	message(LOG_FATAL, "error writing %s: %s\n", checkpoint_file,
+		strerror(errno));
+    free(tmp);
+    message(LOG_VERBOSE, "sweep interrupted, checkpoint written to %s\n",
+	    checkpoint_file);
+}
 
-    if (sb1.st_dev != sb2.st_dev) {
-	message(LOG_ERROR, "device information changed for %s: %s!!!\n",
-		fulldirname, strerror(errno));
-	message(LOG_FATAL, "this indicates a possible intrusion attempt\n");
-	return 1;
-    } else if (sb1.st_ino != sb2.st_ino) {
-	message(LOG_ERROR, "inode information changed for %s: %s!!!\n",
-		fulldirname, strerror(errno));
-	message(LOG_FATAL, "this indicates a possible intrustion attempt\n");
-	return 1;
+/* Read checkpoint_file, if it exists, into resume_root and the resume
+   position of tw */
+static void
+read_checkpoint(void)
+{
+    struct tmpwatch_position *levels;
+    size_t num_levels, allocated, i;
+    FILE *f;
+    char *line;
+    size_t line_size;
+
+    if ((f = fopen(checkpoint_file, "r")) == NULL) {
+	if (errno != ENOENT)
+	    message(LOG_FATAL, "cannot open %s: %s\n", checkpoint_file,
+		    strerror(errno));
+	return;
     }
+    line = NULL;
+    line_size = 0;
+    levels = NULL;
+    num_levels = 0;
+    allocated = 0;
+    if (getline(&line, &line_size, f) == -1
+	|| strcmp(line, CHECKPOINT_HEADER) != 0)
+	goto bad;
+    while (getline(&line, &line_size, f) != -1) {
+	struct tmpwatch_position *l;
+	uintmax_t dev, ino;
+	long pos;
+	int name_start;
+
+	line[strcspn(line, "\n")] = 0;
+	if (resume_root == NULL) {
+	    if (strncmp(line, "root ", 5) != 0)
+		goto bad;
+	    unescape(line + 5);
+	    if ((resume_root = strdup(line + 5)) == NULL)
+		message(LOG_FATAL, "error allocating memory\n");
+	    continue;
+	}
+	if (sscanf(line, "level %ju %ju %ld %n", &dev, &ino, &pos,
+		   &name_start) != 3 || line[name_start] == 0)
+	    goto bad;
+	if (num_levels == allocated) {
+	    allocated = allocated == 0 ? 16 : 2 * allocated;
+	    levels = reallocarray(levels, allocated, sizeof(*levels));
+	    if (levels == NULL)
+		message(LOG_FATAL, "error allocating memory\n");
+	}
+	l = &levels[num_levels];
+	l->dev = dev;
+	l->ino = ino;
+	l->pos = pos;
+	unescape(line + name_start);
+	if ((l->name = strdup(line + name_start)) == NULL)
+	    message(LOG_FATAL, "error allocating memory\n");
+	num_levels++;
+    }
+    if (ferror(f) || resume_root == NULL || num_levels == 0)
+	goto bad;
+    if (tmpwatch_resume(tw, levels, num_levels) != 0)
+	message(LOG_FATAL, "error allocating memory\n");
+    message(LOG_DEBUG, "resuming %s from %s\n", resume_root, checkpoint_file);
+    goto out;
+
+bad:
+    message(LOG_ERROR, "%s is not a valid checkpoint, ignoring it\n",
+	    checkpoint_file);
+    free(resume_root);
+    resume_root = NULL;
+out:
+    for (i = 0; i < num_levels; i++)
+	free(levels[i].name);
+    free(levels);
+    free(line);
+    fclose(f);
+}
 
+/* Compare two manifest record pointers by their inode identity */
+static int
+cmp_manifest_inodes(const void *xa, const void *xb)
+{
+    const struct manifest_record *const *a, *const *b;
+
+    a = xa;
+    b = xb;
+    if ((*a)->dev != (*b)->dev)
+	return (*a)->dev < (*b)->dev ? -1 : 1;
+    if ((*a)->ino != (*b)->ino)
+	return (*a)->ino < (*b)->ino ? -1 : 1;
     return 0;
 }
 
-/* check user function returns 0 if OK, 1 if file in use */
-#ifdef FUSER
+/* Change to the directory described by manifest record D.
+   Return 0 if OK, -1 if it can not be entered or is no longer the directory
+   that was scanned. */
 static int
-check_fuser(const char *filename)
+enter_manifest_dir(const struct manifest_record *d)
 {
-    static int fuser_exists = -1;
-    static char *const empty_environ[] = { NULL };
-
-    int ret = 0;			/* assume no file in use */
-    int wstatus;			/* store return from waitpid */
-    char dir[2 + PATH_MAX];
-    int pid;
-
-    if (fuser_exists == -1)
-	fuser_exists = access(FUSER, R_OK | X_OK) == 0;
-    if (!fuser_exists)
-	return 0;
+    struct stat sb;
+    int fd;
 
-    /* should we close all unnecessary file descriptors here? */
+    fd = open(d->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (fd == -1) {
+	if (errno != ENOENT)
+	    message(LOG_ERROR, "cannot open directory %s: %s\n", d->name,
+		    strerror(errno));
+	return -1;
+    }
+    if (fstat(fd, &sb) != 0 || sb.st_dev != d->dev || sb.st_ino != d->ino) {
+	message(LOG_ERROR, "directory %s changed since the scan, skipping\n",
+		d->name);
+	close(fd);
+	return -1;
+    }
+    if (fchdir(fd) != 0) {
+	message(LOG_ERROR, "chdir to directory %s failed: %s\n", d->name,
+		strerror(errno));
+	close(fd);
+	return -1;
+    }
+    close(fd);
+    return 0;
+}
 
-    /* Use "./" to protect against filenames starting with '-' */
-    snprintf(dir, sizeof(dir), "./%s", filename);
-    pid = fork();
-    if (pid == 0) {
-#ifdef FUSER_ACCEPTS_S
-	execle(FUSER, FUSER, "-s", dir, NULL, empty_environ);
-#else
-	freopen("/dev/null", "w", stdout);
-	freopen("/dev/null", "w", stderr);
-	execle(FUSER, FUSER, dir, NULL, empty_environ);
-#endif
-	_exit(127);
-    } else {
-	waitpid(pid, &wstatus, 0);
+/* Remove the entries listed in manifest FILE.  Files are removed in inode
+   order, directories afterwards in the order they were scanned, so that each
+   directory comes after its contents. */
+static void
+apply_manifest(const char *file)
+{
+    struct manifest_map map;
+    const struct manifest_record *r, **records, **files, **dirs;
+    size_t num_records, num_files, num_dirs, i;
+    uint32_t current_dir;
+    int current_dir_ok;
+
+    if (manifest_map(file, &map) != 0)
+	message(LOG_FATAL, "cannot read manifest %s: %s\n", file,
+		strerror(errno));
+    num_records = map.header->records;
+    if (num_records > map.size / sizeof(*r))
+	message(LOG_FATAL, "manifest %s is corrupt\n", file);
+    records = malloc(num_records * sizeof(*records) + 1);
+    files = malloc(num_records * sizeof(*files) + 1);
+    dirs = malloc(num_records * sizeof(*dirs) + 1);
+    if (records == NULL || files == NULL || dirs == NULL)
+	message(LOG_FATAL, "error allocating memory\n");
+
+    num_files = 0;
+    num_dirs = 0;
+    i = 0;
+    for (r = manifest_next(&map, NULL); r != NULL; r = manifest_next(&map, r)) {
+	if (i == num_records)
+	    break;
+	if (r->type == MANIFEST_ENTRY) {
+	    if (r->dir >= i || records[r->dir]->type != MANIFEST_DIR)
+		break;
+	    if (r->reason == TMPWATCH_REASON_EMPTYDIR)
+		dirs[num_dirs++] = r;
+	    else
+		files[num_files++] = r;
+	} else if (r->type != MANIFEST_DIR)
+	    break;
+	records[i++] = r;
+    }
+    if (i != num_records || r != NULL)
+	message(LOG_FATAL, "manifest %s is corrupt\n", file);
+    message(LOG_DEBUG, "manifest %s: %zu files, %zu directories\n", file,
+	    num_files, num_dirs);
+
+    qsort(files, num_files, sizeof(*files), cmp_manifest_inodes);
+
+    current_dir = 0;
+    current_dir_ok = 0;
+    for (i = 0; i < num_files + num_dirs; i++) {
+	const struct manifest_record *d;
+
+	r = i < num_files ? files[i] : dirs[i - num_files];
+	if (i == 0 || r->dir != current_dir) {
+	    current_dir = r->dir;
+	    current_dir_ok = enter_manifest_dir(records[current_dir]) == 0;
+	}
+	if (!current_dir_ok)
+	    continue;
+	d = records[current_dir];
+	tmpwatch_apply(tw, d->name, r->name, r->dev, r->ino, r->mode,
+		       r->flags, r->threshold, r->reason);
     }
 
-    /* assume return is 0 */
-    /* Even if a file is in use, WIFEXITED can still return a normal termiination */
-    if (WIFEXITED(wstatus))		/* child returned normally */
-    {
-        if (! WEXITSTATUS(wstatus))	/* if some error returned */
-	    ret = 1;
-    } else
-	ret = 1;			/* abnormal exit for child */
+    free(dirs);
+    free(files);
+    free(records);
+    manifest_unmap(&map);
+}
 
-    return ret;
 
+static void
+printCopyright(void)
+{
+    fprintf(stderr, "tmpwatch " PACKAGE_VERSION
+	    " - (C) 1997-2009 Red Hat, Inc. "
+	    "All rights reserved.\n"
+	    "2019-2024 Peter Hyman.\n"
+	    "This program may be freely redistributed under the terms of the\n"
+	    "GNU General Public License version 2.\n");
 }
-#else
-#define check_fuser(FILENAME) 0
-#endif
 
-static time_t *
-max(time_t *x, time_t *y)
+
+static void attribute__((noreturn))
+usage(void)
 {
-    if ( x==0 ) return y;
-    if ( y==0 ) return x;
+    static const char msg[] = "tmpwatch [-u|-m|-c] [-MUX"
+#ifdef SHRED
+	"S"
+#endif	
+	"adfq"
+#ifdef HAVE_FUSER_OPTION
+	"s"
+#endif	
+	"tvx] [--verbose] "
+	"[--force] [--all] [--nodirs] [--nosymlinks] [--test] [--quiet] "
+	"[--atime|--mtime|--ctime] [--dirmtime] [--exclude <path>] "
+	"[--exclude-user <user>] [--exclude-pattern <pattern>] "
+	"[--scan-to <file>] [--deadline <time>] [--checkpoint <file>] "
+	"[--profile <file>] [--max-open-dirs <n>] [--estimate[=<n>]] "
+	"[--simulate <settings>] [--unbound-sockets] "
+	"[--shard <i>/<n>[,<depth>]] [--quarantine] [--purge-quarantine] "
+#ifdef HAVE_PTHREAD_H
+	"[--pipeline <n>] [--status-socket <path>] "
+	"[--truncate <size>[,<step>[,<pause>]]] "
+#endif
+#ifdef SHRED
+	"[--shred] "
+#endif
+#ifdef HAVE_FUSER_OPTION
+	"[--fuser] "
+#endif
+	"<hours-untouched> <dirs>\n"
+	"tmpwatch [options] --config <file>\n"
+	"tmpwatch [-dfqtv] "
+#ifdef SHRED
+	"[--shred] "
+#endif
+#ifdef HAVE_FUSER_OPTION
+	"[--fuser] "
+#endif
+	"--apply <file>\n";
 
-    return (*x>=*y) ? x : y;
+    printCopyright();
+    fprintf(stderr, "\n");
+    fprintf(stderr, msg);
+    exit(1);
 }
 
-#ifdef __linux
+
+/* Parse a time argument ARG.
+   Return the grace period in minutes, or -1 if ARG is invalid. */
 static int
-is_mount_point(const char *path)
+parse_grace(const char *arg)
 {
-    FILE *fp;
-    struct mntent *mnt;
-    int ret;
-
-    if ((fp = setmntent(_PATH_MOUNTED, "r")) == NULL) {
-	message(LOG_ERROR, "failed to open %s for reading\n", _PATH_MOUNTED);
-	return -1;
-    }
+    int grace;
+    char units, garbage;
 
-    ret = 0;
-    while ((mnt = getmntent(fp)) != NULL) {
-	if (strcmp(mnt->mnt_dir, path) == 0) {
-	    ret = 1;
+    switch (sscanf(arg, "%d%c%c", &grace, &units, &garbage)) {
+    case 1:
+	grace *= 60;
+	break; /* hours by default */
+    case 2:
+	switch (units) {
+	case 'd':
+	    grace *= 24 * 60; /* days to minutes */
+	    break;
+	case 'h':
+	    grace *= 60; /* hours to minutes */
 	    break;
+	case 'm':
+	    break; /* minutes */
+	default:
+	    grace = -1;  /* invalid */
 	}
+	break;
+    default:
+	grace = -1; /* invalid */
     }
-    endmntent(fp);
-
-    return ret;
+    return grace < 0 ? -1 : grace;
 }
-#endif
 
-/* added shredpath */
-static int
-cleanupDirectory(const char * fulldirname, const char *reldirname, dev_t st_dev,
-		 ino_t st_ino, const char *shredpath)
-{
-    DIR *dir;
-    struct dirent *ent;
-    struct stat sb, here;
-    time_t *significant_time;
-    struct utimbuf utb;
-    int res;
-    int pid;
-
-    message(LOG_DEBUG, "cleaning up directory %s\n", fulldirname);
-
-    res = safe_chdir(fulldirname, reldirname, st_dev, st_ino);
-    switch (res) {
-    case 0: /* OK */
-	break;
 
-    case 1: /* Error */
-	return 0;
+/* Parse a size at the start of ARG, in bytes or with a k, M, G or T suffix,
+   and store the end of the size in *END.
+   Return the size in bytes, or -1 if it is invalid. */
+static off_t
+parse_size(const char *arg, char **end)
+{
+    static const char units[] = "kMGT";
 
-    case 2: /* ENOENT, silently do nothing */
-	return 1;
-    }
+    uintmax_t size;
+    const char *unit;
 
-    if (lstat(".", &here) != 0) {
-	message(LOG_ERROR, "error stat()ing current directory %s: %s\n",
-		fulldirname, strerror(errno));
-	return 0;
+    errno = 0;
+    size = strtoumax(arg, end, 10);
+    if (errno != 0 || *end == arg || !isdigit((unsigned char)*arg))
+	return -1;
+    if (**end != '\0' && (unit = strchr(units, **end)) != NULL) {
+	int shift;
+
+	shift = 10 * (unit - units + 1);
+	if (size > (UINTMAX_MAX >> shift))
+	    return -1;
+	size <<= shift;
+	(*end)++;
     }
+    if ((off_t)size < 0 || (uintmax_t)(off_t)size != size)
+	return -1;
+    return size;
+}
 
-    /* Don't cross filesystems */
-    if (here.st_dev != st_dev) {
-	message(LOG_ERROR, "directory %s device changed right under us!!!\n",
-		fulldirname);
-	message(LOG_FATAL, "this indicates a possible intrustion attempt\n");
-	return 1;
-    }
 
-    /* Check '.' and expected inode */
-    if (here.st_ino != st_ino) {
-	message(LOG_ERROR, "directory %s inode changed right under us!!!\n",
-		fulldirname);
-	message(LOG_FATAL, "this indicates a possible intrusion attempt\n");
-	return 1;
+/* Parse the number at the start of *ARG, and advance *ARG past it.
+   Return 0 if OK, -1 if there is no valid number. */
+static int
+parse_unsigned(const char **arg, unsigned *value)
+{
+    unsigned long ul;
+    char *end;
+
+    if (!isdigit((unsigned char)**arg))
+	return -1;
+    errno = 0;
+    ul = strtoul(*arg, &end, 10);
+    if (errno != 0 || ul > UINT_MAX)
+	return -1;
+    *value = ul;
+    *arg = end;
+    return 0;
+}
+
+/* Parse a --shard argument ARG, INDEX/COUNT[,DEPTH], into *INDEX, *COUNT
+   and, if given, *DEPTH.
+   Return 0 if OK, -1 if ARG is invalid. */
+static int
+parse_shard(const char *arg, unsigned *index, unsigned *count,
+	    unsigned *depth)
+{
+    if (parse_unsigned(&arg, index) != 0 || *arg++ != '/'
+	|| parse_unsigned(&arg, count) != 0)
+	return -1;
+    if (*arg == ',') {
+	arg++;
+	if (parse_unsigned(&arg, depth) != 0 || *depth == 0)
+	    return -1;
     }
+    return *arg != 0 || *count == 0 || *index >= *count ? -1 : 0;
+}
+
 
-    if ((dir = opendir(".")) == NULL) {
-	message(LOG_ERROR, "opendir error on current directory %s: %s\n",
-		fulldirname, strerror(errno));
+/* Look up USER (a name or numeric UID) and store its UID in *UID.
+   Return 0 if OK, -1 if USER is unknown. */
+static int
+lookup_user(const char *user, uid_t *uid)
+{
+    struct passwd *pwd;
+    intmax_t imax;
+    char *p;
+
+    pwd = getpwnam(user);
+    if (pwd != NULL) {
+	*uid = pwd->pw_uid;
 	return 0;
     }
+    errno = 0;
+    imax = strtoimax(user, &p, 10);
+    if (errno != 0 || *p != 0 || p == user || (uid_t)imax != imax)
+	return -1;
+    *uid = imax;
+    return 0;
+}
 
-    for (;;) {
-	struct exclusion *e;
+/* Add a command-line exclusion OPTION with ARG and UID */
+static void
+add_cli_exclusion(int option, const char *arg, uid_t uid)
+{
+    struct cli_exclusion *e;
+
+    if ((e = malloc(sizeof (*e))) == NULL)
+	message(LOG_FATAL, "error allocating memory\n.");
+    e->option = option;
+    e->arg = arg;
+    e->uid = uid;
+    e->next = NULL;
+    *cli_exclusions_tail = e;
+    cli_exclusions_tail = &e->next;
+}
 
-	errno = 0;
-	ent = readdir(dir);
-	if (errno != 0) {
-	    message(LOG_ERROR, "error reading directory entry: %s\n",
-		    strerror(errno));
-	    (void)closedir(dir);
-	    return 0;
-	}
-	if (ent == NULL)
-	    break;
+/* Add the command-line exclusions to POLICY */
+static void
+apply_cli_exclusions(struct tmpwatch_policy *policy)
+{
+    const struct cli_exclusion *e;
 
-	if (lstat(ent->d_name, &sb) != 0) {
-	    /* FUSE mounts by different users return EACCES by default. */
-	    if (errno != ENOENT && errno != EACCES)
-		message(LOG_ERROR, "failed to lstat %s/%s: %s\n",
-			fulldirname, ent->d_name, strerror(errno));
-	    continue;
-	}
+    for (e = cli_exclusions; e != NULL; e = e->next) {
+	int res;
 
-	/* don't go crazy with the current directory or its parent */
-	if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
-	    continue;
+	switch (e->option) {
+	case 'x':
+	    res = tmpwatch_policy_exclude(policy, e->arg);
+	    break;
+	case 'X':
+	    res = tmpwatch_policy_exclude_pattern(policy, e->arg);
+	    break;
+	default: /* 'U' */
+	    res = tmpwatch_policy_exclude_uid(policy, e->uid);
+	    break;
+	}
+	if (res != 0)
+	    message(LOG_FATAL, "error allocating memory\n");
+    }
+}
 
-	/*
-	 * skip over directories named lost+found that are owned by
-	 * LOSTFOUND_UID (root)
-	 */
-	if (strcmp(ent->d_name, "lost+found") == 0 && S_ISDIR(sb.st_mode)
-	    && sb.st_uid == LOSTFOUND_UID)
-	    continue;
+static int
+cmp_policies(const void *xa, const void *xb)
+{
+    const struct tmpwatch_policy *const *a, *const *b;
 
-	message(LOG_REALDEBUG, "found directory entry %s\n", ent->d_name);
+    a = xa;
+    b = xb;
+    return strcmp(tmpwatch_policy_root(*a), tmpwatch_policy_root(*b));
+}
 
-	for (e = exclusions; e != NULL; e = e->next) {
-	    if (strcmp(fulldirname, e->dir) == 0
-		&& strcmp(ent->d_name, e->file) == 0) {
-		message(LOG_REALDEBUG, "in exclusion list, skipping\n");
-		break;
-	    }
-	}
-	if (e != NULL)
+/* Read --config FILE into policies.
+
+   Each non-empty line not starting with '#' is a rule
+	PATH TIME [OPTION]...
+   TIME has the syntax of the command-line time argument, OPTION is one of the
+   long options atime, mtime, ctime, dirmtime, all, nodirs, nosymlinks, force,
+   unbound-sockets, exclude=PATH, exclude-user=USER and
+   exclude-pattern=PATTERN, optionally
+   preceded by "--".  Command-line options apply to all rules; a rule that
+   selects any of atime, mtime and ctime overrides that part of the
+   command line. */
+static void
+read_config(const char *file)
+{
+    static const struct {
+	const char *name;
+	int flag;
+    } flag_options[] = {
+	{ "atime", TMPWATCH_ATIME },
+	{ "mtime", TMPWATCH_MTIME },
+	{ "ctime", TMPWATCH_CTIME },
+	{ "dirmtime", TMPWATCH_DIRMTIME },
+	{ "all", TMPWATCH_ALLFILES },
+	{ "nodirs", TMPWATCH_NODIRS },
+	{ "nosymlinks", TMPWATCH_NOSYMLINKS },
+	{ "force", TMPWATCH_FORCE },
+	{ "unbound-sockets", TMPWATCH_UNBOUND_SOCKETS },
+    };
+#define TIME_SELECTION (TMPWATCH_ATIME | TMPWATCH_MTIME | TMPWATCH_CTIME)
+
+    FILE *f;
+    char *line, **words;
+    size_t line_size, allocated, words_allocated, i;
+    unsigned lineno;
+
+    if ((f = fopen(file, "r")) == NULL)
+	message(LOG_FATAL, "cannot open %s: %s\n", file, strerror(errno));
+    line = NULL;
+    line_size = 0;
+    allocated = 0;
+    words = NULL;
+    words_allocated = 0;
+    lineno = 0;
+    while (getline(&line, &line_size, f) != -1) {
+	struct tmpwatch_policy *p;
+	char *word, *save, *root;
+	size_t num_words, j;
+	int grace, rule_flags;
+
+	lineno++;
+	word = strtok_r(line, " \t\n", &save);
+	if (word == NULL || *word == '#')
 	    continue;
 
-	if (excluded_patterns != NULL) {
-	    const struct excluded_pattern *ep;
-	    char *full, *p;
+	if (num_policies == allocated) {
+	    allocated = allocated == 0 ? 16 : 2 * allocated;
+	    policies = reallocarray(policies, allocated, sizeof(*policies));
+	    if (policies == NULL)
+		message(LOG_FATAL, "error allocating memory\n");
+	}
 
-	    full = malloc(strlen(fulldirname) + strlen(ent->d_name) + 2);
-	    if (full == NULL)
+	root = absolute_path(word, 1);
+	if (*root != '/')
+	    message(LOG_FATAL, "%s:%u: %s is not an absolute path\n", file,
+		    lineno, root);
+	word = strtok_r(NULL, " \t\n", &save);
+	if (word == NULL)
+	    message(LOG_FATAL, "%s:%u: time expected\n", file, lineno);
+	if ((grace = parse_grace(word)) < 0)
+	    message(LOG_FATAL, "%s:%u: bad time argument %s\n", file, lineno,
+		    word);
+
+	/* The flags are needed to create the rule, so the exclusions are
+	   added in a second pass */
+	rule_flags = 0;
+	num_words = 0;
+	while ((word = strtok_r(NULL, " \t\n", &save)) != NULL) {
+	    char *value;
+
+	    if (strncmp(word, "--", 2) == 0)
+		word += 2;
+	    value = strchr(word, '=');
+	    if (value != NULL) {
+		if (num_words == words_allocated) {
+		    words_allocated = words_allocated == 0 ? 16
+			: 2 * words_allocated;
+		    words = reallocarray(words, words_allocated,
+					 sizeof(*words));
+		    if (words == NULL)
+			message(LOG_FATAL, "error allocating memory\n");
+		}
+		words[num_words++] = word;
 		continue;
-	    p = stpcpy(full, fulldirname);
-	    p = stpcpy(p, "/");
-	    stpcpy(p, ent->d_name);
-	    for (ep = excluded_patterns; ep != NULL; ep = ep->next) {
-		if (fnmatch(ep->pattern, full,
-			    FNM_PATHNAME | FNM_PERIOD) == 0) {
-		    message(LOG_REALDEBUG,
-			    "matches exclusion pattern, skipping\n");
+	    }
+	    for (i = 0; i < sizeof(flag_options) / sizeof(*flag_options); i++) {
+		if (strcmp(word, flag_options[i].name) == 0)
 		    break;
-		}
 	    }
-	    free(full);
-	    if (ep != NULL)
-		continue;
+	    if (i == sizeof(flag_options) / sizeof(*flag_options))
+		message(LOG_FATAL, "%s:%u: unknown option %s\n", file, lineno,
+			word);
+	    rule_flags |= flag_options[i].flag;
 	}
 
-	significant_time = 0;
-	/* Set significant_time to point at the significant field of sb -
-	 * either st_atime or st_mtime depending on the flag selected. - alh */
-	if ((config_flags & FLAG_DIRMTIME) != 0 && S_ISDIR(sb.st_mode))
-	    significant_time = max(significant_time, &sb.st_mtime);
-	/* The else here (and not elsewhere) is intentional */
-	else if ((config_flags & FLAG_ATIME) != 0)
-	    significant_time = max(significant_time, &sb.st_atime);
-	if ((config_flags & FLAG_MTIME) != 0)
-	    significant_time = max(significant_time, &sb.st_mtime);
-	if ((config_flags & FLAG_CTIME) != 0) {
-	    /* Even when we were told to use ctime, for directories we use
-	       mtime, because when a file in a directory is deleted, its
-	       ctime will change, and there's no way we can change it
-	       back.  Therefore, we use mtime rather than ctime so that
-	       directories won't hang around for a long time after their
-	       contents are removed. */
-	    if (S_ISDIR(sb.st_mode))
-		significant_time = max(significant_time, &sb.st_mtime);
-	    else
-		significant_time = max(significant_time, &sb.st_ctime);
-	}
-	/* What? One or the other should be set by now... */
-	if (significant_time == 0) {
-	    message(LOG_FATAL, "error in cleanupDirectory: no selection method "
-		    "was specified\n");
-	}
-
-	message(LOG_REALDEBUG, "taking as significant time: %s",
-		ctime(significant_time));
-
-	if (sb.st_uid == 0 && (config_flags & FLAG_FORCE) == 0
-	    && (sb.st_mode & S_IWUSR) == 0) {
-	    message(LOG_DEBUG, "non-writeable file owned by root "
-		    "skipped: %s\n", ent->d_name);;
-	    continue;
+	if ((rule_flags & TIME_SELECTION) != 0)
+	    rule_flags |= config_flags & ~TIME_SELECTION;
+	else
+	    rule_flags |= config_flags;
+	if ((p = tmpwatch_policy_new(tw, root, rule_flags, grace)) == NULL)
+	    message(LOG_FATAL, "%s:%u: cannot create rule: %s\n", file, lineno,
+		    strerror(errno));
+	free(root);
+
+	for (j = 0; j < num_words; j++) {
+	    char *value;
+	    uid_t uid;
+
+	    word = words[j];
+	    value = strchr(word, '=');
+	    *value++ = 0;
+	    if (strcmp(word, "exclude") == 0) {
+		if (tmpwatch_policy_exclude(p, value) != 0)
+		    message(LOG_FATAL, "%s:%u: invalid exclusion\n", file,
+			    lineno);
+	    } else if (strcmp(word, "exclude-user") == 0) {
+		if (lookup_user(value, &uid) != 0)
+		    message(LOG_FATAL, "%s:%u: unknown user %s\n", file,
+			    lineno, value);
+		if (tmpwatch_policy_exclude_uid(p, uid) != 0)
+		    message(LOG_FATAL, "error allocating memory\n");
+	    } else if (strcmp(word, "exclude-pattern") == 0) {
+		if (tmpwatch_policy_exclude_pattern(p, value) != 0)
+		    message(LOG_FATAL, "error allocating memory\n");
+	    } else
+		message(LOG_FATAL, "%s:%u: unknown option %s\n", file, lineno,
+			word);
 	}
-	/* One more check for a different device.  Try hard not to go onto a
-	   different device. */
-	if (sb.st_dev != st_dev || here.st_dev != st_dev) {
-	    message(LOG_VERBOSE, "file on different device skipped: %s\n",
-		    ent->d_name);
-	    continue;
+	/* Command-line exclusions apply to all rules */
+	apply_cli_exclusions(p);
+	if (tmpwatch_add_rule(tw, p) != 0) {
+	    if (errno == EEXIST)
+		message(LOG_FATAL, "%s:%u: more than one rule for %s\n",
+			file, lineno, tmpwatch_policy_root(p));
+	    message(LOG_FATAL, "error allocating memory\n");
 	}
-	if (S_ISDIR(sb.st_mode)) {
-	    int dd;
-
-	    if ((dd = open(".", O_RDONLY)) != -1) {
-		char *full_subdir;
-
-		full_subdir = malloc(strlen(fulldirname) + strlen(ent->d_name)
-				     + 2);
-
-		if (full_subdir != NULL) {
-		    strcpy(full_subdir, fulldirname);
-		    strcat(full_subdir, "/");
-		    strcat(full_subdir, ent->d_name);
-		    if (!is_bind_mount(full_subdir)
-			&& cleanupDirectory(full_subdir, ent->d_name, st_dev,
-					    sb.st_ino, shredpath) == 0)
-			message(LOG_ERROR, "cleanup failed in %s: %s\n",
-				full_subdir, strerror(errno));
-		    free(full_subdir);
-		}
-		if (fchdir(dd) != 0) {
-		    message(LOG_ERROR, "can not return to %s: %s\n",
-			    fulldirname, strerror(errno));
-		    close(dd);
-		    break;
-		}
-		close(dd);
-	    } else {
-		message(LOG_ERROR, "could not perform cleanup in %s/%s: %s\n",
-			fulldirname, ent->d_name, strerror(errno));
-	    }
-
-	    if (*significant_time >= kill_time)
-		continue;
-
-	    if ((config_flags & FLAG_FUSER) != 0 && check_fuser(ent->d_name)) {
-		message(LOG_VERBOSE, "file is already in use or open: %s\n",
-			ent->d_name);
-		continue;
-	    }
-
-	    /* we should try to remove the directory after cleaning up its
-	       contents, as it should contain no files.  Skip if we have
-	       specified the "no directories" flag. */
-	    if ((config_flags & FLAG_NODIRS) == 0) {
-		message(LOG_VERBOSE, "removing directory %s/%s if empty\n",
-			fulldirname, ent->d_name);
-
-		if ((config_flags & FLAG_TEST) == 0) {
-		    if (rmdir(ent->d_name)) {
-			/* EBUSY is returned for a mount point. */
-			if (errno != ENOENT && errno != ENOTEMPTY
-			    && errno != EBUSY) {
-			    message(LOG_ERROR, "failed to rmdir %s/%s: %s\n",
-				    fulldirname, ent->d_name, strerror(errno));
-			}
-		    }
-		}
-	    }
-	} else {
-	    if (S_ISSOCK(sb.st_mode)) {
-		if (socket_kill_time == 0
-		    || *significant_time >= socket_kill_time)
-		    continue;
-	    } else { /* Not a socket */
-		if (*significant_time >= kill_time)
-		    continue;
-	    }
+	policies[num_policies++] = p;
+    }
+    if (ferror(f))
+	message(LOG_FATAL, "error reading %s: %s\n", file, strerror(errno));
+    free(words);
+    free(line);
+    fclose(f);
+#undef TIME_SELECTION
+
+    if (num_policies == 0)
+	message(LOG_FATAL, "no rules in %s\n", file);
+    qsort(policies, num_policies, sizeof(*policies), cmp_policies);
+    for (i = 1; i < num_policies; i++) {
+	if (strcmp(tmpwatch_policy_root(policies[i - 1]),
+		   tmpwatch_policy_root(policies[i])) == 0)
+	    message(LOG_FATAL, "%s: more than one rule for %s\n", file,
+		    tmpwatch_policy_root(policies[i]));
+    }
+}
 
-#ifdef __linux
-	    /* check if it is an ext3 journal file */
-	    if (strcmp(ent->d_name, ".journal") == 0 && sb.st_uid == 0) {
-		int mount;
-
-		mount = is_mount_point(fulldirname);
-		if (mount == -1)
-		    continue;
-		if (mount != 0) {
-		    message(LOG_VERBOSE, "skipping ext3 journal file: %s/%s\n",
-			    fulldirname, ent->d_name);
-		    continue;
-		}
-	    }
-	    if (strcmp(ent->d_name, "aquota.user") == 0 ||
-		strcmp(ent->d_name, "aquota.group") == 0) {
-		int mount;
-
-		mount = is_mount_point(fulldirname);
-		if (mount == -1)
-		    continue;
-		if (mount != 0) {
-		    message(LOG_VERBOSE, "skipping quota file: %s/%s\n",
-			    fulldirname, ent->d_name);
-		    continue;
-		}
-	    }
-#endif
+/* Add a rule for each of the N command-line ROOTS with GRACE to policies,
+   in the order given, so that a root nested in another one is cleaned up
+   only once.  Roots that name a directory given before are dropped. */
+static void
+add_cli_roots(char **roots, int n, int grace)
+{
+    int i;
+
+    policies = reallocarray(NULL, n, sizeof(*policies));
+    if (policies == NULL)
+	message(LOG_FATAL, "error allocating memory\n");
+    for (i = 0; i < n; i++) {
+	struct tmpwatch_policy *p;
+	char *root;
+
+	/* Paths in a simulated tree are not on the disk */
+	if (simfs != NULL) {
+	    if (*roots[i] != '/')
+		message(LOG_FATAL, "%s is not an absolute path\n", roots[i]);
+	    if ((root = strdup(roots[i])) == NULL)
+		message(LOG_FATAL, "error allocating memory\n");
+	} else
+	    root = absolute_path(roots[i], 0);
+	p = tmpwatch_policy_new(tw, root, config_flags, grace);
+	if (p == NULL)
+	    message(LOG_FATAL, "no selection method was specified\n");
+	apply_cli_exclusions(p);
+	if (tmpwatch_add_rule(tw, p) != 0) {
+	    if (errno != EEXIST)
+		message(LOG_FATAL, "error allocating memory\n");
+	    message(LOG_VERBOSE, "%s is the same directory as an earlier "
+		    "one, skipping\n", root);
+	} else
+	    policies[num_policies++] = p;
+	free(root);
+    }
+}
 
-	    if ((config_flags & FLAG_ALLFILES) != 0
-		|| S_ISREG(sb.st_mode) || S_ISSOCK(sb.st_mode)
-		|| ((config_flags & FLAG_NOSYMLINKS) == 0
-		    && S_ISLNK(sb.st_mode))) {
-		const struct excluded_uid *u;
-
-		if ((config_flags & FLAG_FUSER) != 0
-		    && check_fuser(ent->d_name)) {
-		    message(LOG_VERBOSE, "file is already in use or open: %s/%s\n",
-			    fulldirname, ent->d_name);
-		    continue;
-		}
+/* Forget the checkpoint read by read_checkpoint() */
+static void
+discard_resume(void)
+{
+    message(LOG_VERBOSE, "%s is not being cleaned up, ignoring checkpoint\n",
+	    resume_root);
+    free(resume_root);
+    resume_root = NULL;
+    tmpwatch_resume(tw, NULL, 0);
+}
 
-                for (u = excluded_uids; u != NULL; u = u->next) {
-                    if (sb.st_uid == u->uid) {
-	                message(LOG_REALDEBUG,
-				"file owner excluded, skipping\n");
-                        break;
-                    }
-                }
-                if (u != NULL)
-                    continue;
-
-		if ((config_flags & FLAG_TEST) == 0) {
-		    /* shred files if requested */
-		    if ((config_flags & FLAG_SHRED) != 0) {
-		        pid = fork();
-			if (pid == 0) {
-			    message(LOG_VERBOSE, "shredding file %s/%s\n",
-				fulldirname, ent->d_name);
-			    /* use shred verbosity according to logLevel */
-			    /* force file shred if required */
-			    int shredoptionsindex=0;
-			    char shredoptions[4]; /* v, f, vf or nothing*/
-			    if (logLevel < LOG_NORMAL)
-			        shredoptionsindex=1;
-			    if (config_flags & FLAG_FORCE)
-				shredoptionsindex+=2;
-
-			    switch ( shredoptionsindex ) {
-			    case 1: strcpy( shredoptions, "-v" );
-				    break;
-			    case 2: strcpy( shredoptions, "-f" );
-				    break;
-			    case 3: strcpy( shredoptions, "-vf" );
-				    break;
-			    default:
-				    break;
-			    }
-			    /* check if v or f required */
-			    if (shredoptionsindex)
-				execl( shredpath, "shred", shredoptions, ent->d_name, (char *) NULL );
-			    else
-				execl( shredpath, "shred", ent->d_name, (char *) NULL );
-
-			    /* something went wrong */
-			    message(LOG_ERROR, "shred program not found. No shredding will occur for files.\n");
-			    _exit(-1);
-			} else
-			    wait(0);
-		    }
-		    message(LOG_VERBOSE, "removing file %s/%s\n",
-			fulldirname, ent->d_name);
-
-		    if (unlink(ent->d_name) != 0 && errno != ENOENT)
-			message(LOG_ERROR, "failed to unlink %s: %s\n",
-			    fulldirname, ent->d_name);
-		}
-	    }
-	}
+/* Finish a sweep of ROOT, and return to ORIG_DIR.
+   Return 1 if the sweep was interrupted and no other roots should be
+   cleaned up. */
+static int
+end_root(const char *root, int orig_dir)
+{
+    if (fchdir(orig_dir) != 0) {
+	message(LOG_FATAL, "can not return to original working "
+		"directory: %s\n", strerror(errno));
     }
-
-    if (closedir(dir) == -1) {
-	message(LOG_ERROR, "closedir of %s failed: %s\n",
-		fulldirname, strerror(errno));
+    if (!tmpwatch_interrupted(tw))
 	return 0;
-    }
+    if (checkpoint_file != NULL)
+	write_checkpoint(root);
+    else
+	message(LOG_VERBOSE, "deadline reached, sweep of %s stopped\n", root);
+    return 1;
+}
 
-    /* restore access time on this directory to its original time */
-    utb.actime = here.st_atime; /* atime */
-    utb.modtime = here.st_mtime; /* mtime */
+/* Entries examined for each root by --estimate without a number */
+#define DEFAULT_ESTIMATE_ENTRIES 10000
 
-    if (utime(".", &utb) == -1)
-	message(LOG_DEBUG, "unable to reset atime/mtime for %s\n",
-		fulldirname);
+/* Freeing of large files by --truncate without a step or a pause */
+#define DEFAULT_TRUNCATE_STEP (256 * 1024 * 1024)
+#define DEFAULT_TRUNCATE_PAUSE 100 /* Milliseconds */
 
-    return 1;
-}
+/* Directory in each root used by --quarantine */
+#define QUARANTINE_NAME ".tmpwatch-quarantine"
 
+/* Print the lower and upper bound of the 95% confidence interval of
+   ESTIMATE with standard error ERROR */
 static void
-printCopyright(void)
+print_interval(double estimate, double error)
 {
-    fprintf(stderr, "tmpwatch " PACKAGE_VERSION
-	    " - (C) 1997-2009 Red Hat, Inc. "
-	    "All rights reserved.\n"
-	    "2019-2024 Peter Hyman.\n"
-	    "This program may be freely redistributed under the terms of the\n"
-	    "GNU General Public License version 2.\n");
-}
+    double low;
 
+    low = estimate - 1.96 * error;
+    printf("%.0f to %.0f", low > 0 ? low : 0, estimate + 1.96 * error);
+}
 
-static void attribute__((noreturn))
-usage(void)
+/* Print an estimate of what would be removed from each root, examining
+   about MAX_EXAMINED entries for each */
+static void
+estimate_roots(unsigned long max_examined)
 {
-    static const char msg[] = "tmpwatch [-u|-m|-c] [-MUX"
-#ifdef SHRED
-	"S"
-#endif	
-	"adfq"
-#ifdef FUSER
-	"s"
-#endif	
-	"tvx] [--verbose] "
-	"[--force] [--all] [--nodirs] [--nosymlinks] [--test] [--quiet] "
-	"[--atime|--mtime|--ctime] [--dirmtime] [--exclude <path>] "
-	"[--exclude-user <user>] [--exclude-pattern <pattern>] "
-#ifdef SHRED
-	"[--shred] "
-#endif
-#ifdef FUSER
-	"[--fuser] "
-#endif
-	"<hours-untouched> <dirs>\n";
+    size_t i;
 
-    printCopyright();
-    fprintf(stderr, "\n");
-    fprintf(stderr, msg);
-    exit(1);
-}
+    for (i = 0; i < num_policies; i++) {
+	struct tmpwatch_estimate est;
+	const char *root;
 
-/* Set up kill_time and socket_kill_time for GRACE_MINUTES.
+	root = tmpwatch_policy_root(policies[i]);
+	if (tmpwatch_estimate(tw, root, policies[i], max_examined, &est) != 0)
+	    continue;
+	if (est.exact)
+	    printf("%s: %.0f files, %.0f bytes (exact)\n", root, est.files,
+		   est.bytes);
+	else {
+	    printf("%s: %.0f files (", root, est.files);
+	    print_interval(est.files, est.files_error);
+	    printf("), %.0f bytes (", est.bytes);
+	    print_interval(est.bytes, est.bytes_error);
+	    printf("), %lu probes, %lu entries examined\n", est.probes,
+		   est.examined);
+	}
+	if (tmpwatch_interrupted(tw))
+	    break;
+    }
+}
 
-   Connecting to an AF_UNIX socket does not update any of its times, so we
-   can't blindly remove a socket with old times - but any process listening on
-   that socket can not survive a reboot, so sockets that predate the time of
-   our boot are fair game.  We still add the grace period, both as a layer of
-   extra protection, and to let users examine contents of the temporary
-   directory for at least for some time.
- */
+/* Empty the quarantine of each root */
 static void
-compute_kill_times(int grace_minutes)
-{
-    int grace_seconds;
-
-    grace_seconds = grace_minutes * 60;
-    message(LOG_DEBUG, "grace period is %d seconds\n", grace_seconds);
-
-    kill_time = time(NULL) - grace_seconds;
-    if ((config_flags & FLAG_ALLFILES) != 0)
-	socket_kill_time = kill_time;
-    else {
-/* We want __linux because the behavior of CLOCK_BOOTTIME is not standardized.
-   On Linux, it is the time since system boot, including the time spent in
-   sleep mode or hibernation. */
-#if defined (HAVE_CLOCK_GETTIME) && defined (CLOCK_BOOTTIME) && defined (__linux)
-	struct timespec real_clock, boot_clock;
-	time_t boot_time;
-
-	if (clock_gettime(CLOCK_REALTIME, &real_clock) != 0
-	    || clock_gettime(CLOCK_BOOTTIME, &boot_clock) != 0)
-	    message(LOG_FATAL, "Error determining boot time: %s\n",
-		    strerror(errno));
-	boot_time = real_clock.tv_sec - boot_clock.tv_sec;
-	if (real_clock.tv_nsec < boot_clock.tv_nsec)
-	    boot_time--;
-	/* We don't get the values of the two clocks at exactly the same moment,
-	   let's add a few seconds to be extra sure. */
-	boot_time -= 2;
-
-	socket_kill_time = boot_time - grace_seconds;
-#else
-	socket_kill_time = 0; /* Never remove sockets */
-#endif
+purge_roots(void)
+{
+    size_t i;
+
+    for (i = 0; i < num_policies; i++) {
+	tmpwatch_purge_quarantine(tw, tmpwatch_policy_root(policies[i]));
+	if (tmpwatch_interrupted(tw))
+	    break;
     }
 }
 
+/* Long options without a short equivalent */
+enum {
+    OPT_SCAN_TO = UCHAR_MAX + 1,
+    OPT_APPLY,
+    OPT_CONFIG,
+    OPT_DEADLINE,
+    OPT_CHECKPOINT,
+    OPT_PROFILE,
+    OPT_MAX_OPEN_DIRS,
+    OPT_PIPELINE,
+    OPT_ESTIMATE,
+    OPT_SIMULATE,
+    OPT_STATUS_SOCKET,
+    OPT_TRUNCATE,
+    OPT_UNBOUND_SOCKETS,
+    OPT_SHARD,
+    OPT_QUARANTINE,
+    OPT_PURGE_QUARANTINE
+};
+
 int main(int argc, char ** argv)
 {
     static const struct option options[] = {
@@ -757,7 +1017,7 @@ int main(int argc, char ** argv)
 	{ "ctime", 0, 0, 'c' },
 	{ "dirmtime", 0, 0, 'M' },
 	{ "quiet", 0, 0, 'q' },
-#ifdef FUSER
+#ifdef HAVE_FUSER_OPTION
 	{ "fuser", 0, 0, 's' },
 #endif
 	{ "test", 0, 0, 't' },
@@ -767,6 +1027,24 @@ int main(int argc, char ** argv)
 	{ "exclude-pattern", required_argument, 0, 'X' },
 #ifdef SHRED
 	{ "shred", 0, 0, 'S' },
+#endif
+	{ "scan-to", required_argument, 0, OPT_SCAN_TO },
+	{ "apply", required_argument, 0, OPT_APPLY },
+	{ "config", required_argument, 0, OPT_CONFIG },
+	{ "deadline", required_argument, 0, OPT_DEADLINE },
+	{ "checkpoint", required_argument, 0, OPT_CHECKPOINT },
+	{ "profile", required_argument, 0, OPT_PROFILE },
+	{ "max-open-dirs", required_argument, 0, OPT_MAX_OPEN_DIRS },
+	{ "estimate", optional_argument, 0, OPT_ESTIMATE },
+	{ "simulate", required_argument, 0, OPT_SIMULATE },
+	{ "unbound-sockets", 0, 0, OPT_UNBOUND_SOCKETS },
+	{ "shard", required_argument, 0, OPT_SHARD },
+	{ "quarantine", 0, 0, OPT_QUARANTINE },
+	{ "purge-quarantine", 0, 0, OPT_PURGE_QUARANTINE },
+#ifdef HAVE_PTHREAD_H
+	{ "pipeline", required_argument, 0, OPT_PIPELINE },
+	{ "status-socket", required_argument, 0, OPT_STATUS_SOCKET },
+	{ "truncate", required_argument, 0, OPT_TRUNCATE },
 #endif
 	{ 0, 0, 0, 0 },
     };
@@ -776,7 +1054,7 @@ int main(int argc, char ** argv)
     strcpy(optstring, "MU:acdflmqtuvx:X:");
     /* add option strings for FUSER and SHRED. Otherwise options ignored */
     int idx=strlen(optstring);
-    #ifdef FUSER
+    #ifdef HAVE_FUSER_OPTION
         optstring[idx++] = 's';
     #endif
     #ifdef SHRED
@@ -785,17 +1063,25 @@ int main(int argc, char ** argv)
 fprintf(stdout,"%s\n",optstring);
 
 
-    int grace;
-    char units, garbage;
     int orig_dir;
-    struct stat sb;
     char *shredpath = NULL;
+    struct tmpwatch_callbacks callbacks;
+    const char *scan_file = NULL, *apply_file = NULL, *config_file = NULL;
+    const char *profile_file = NULL, *simulate_spec = NULL;
+    const char *status_socket = NULL;
+    unsigned long max_open_dirs = TMPWATCH_DEFAULT_OPEN_DIRS;
+    unsigned long pipeline = 0;
+    off_t truncate_size = 0, truncate_step = DEFAULT_TRUNCATE_STEP;
+    unsigned long truncate_pause = DEFAULT_TRUNCATE_PAUSE;
+    unsigned long estimate = 0;
+    int quarantine = 0, purge_quarantine = 0;
+    unsigned shard_index = 0, shard_count = 1, shard_depth = 1;
+    int deadline = 0;
+    struct sigaction sa;
 
     // set_program_name(argv[0]);
     if (argc == 1) usage();
 
-    bind_mount_init();
-
     while (1) {
 	int arg, long_index;
 
@@ -806,25 +1092,25 @@ fprintf(stdout,"%s\n",optstring);
 
 	switch (arg) {
 	case 'M':
-	    config_flags |= FLAG_DIRMTIME;
+	    config_flags |= TMPWATCH_DIRMTIME;
 	    break;
 	case 'a':
-	    config_flags |= FLAG_ALLFILES;
+	    config_flags |= TMPWATCH_ALLFILES;
 	    break;
 	case 'd':
-	    config_flags |= FLAG_NODIRS;
+	    config_flags |= TMPWATCH_NODIRS;
 	    break;
 	case 'f':
-	    config_flags |= FLAG_FORCE;
+	    config_flags |= TMPWATCH_FORCE;
 	    break;
 	case 'l':
-	    config_flags |= FLAG_NOSYMLINKS;
+	    config_flags |= TMPWATCH_NOSYMLINKS;
 	    break;
 	case 's':
-	    config_flags |= FLAG_FUSER;
+	    config_flags |= TMPWATCH_FUSER;
 	    break;
 	case 't':
-	    config_flags |= FLAG_TEST;
+	    config_flags |= TMPWATCH_TEST;
 	    /* fallthrough */
 	case 'v':
 	    logLevel > 0 ? logLevel -= 1 : 0;
@@ -833,83 +1119,133 @@ fprintf(stdout,"%s\n",optstring);
 	    logLevel = LOG_FATAL;
 	    break;
 	case 'u':
-	    config_flags |= FLAG_ATIME;
+	    config_flags |= TMPWATCH_ATIME;
 	    break;
 	case 'm':
-	    config_flags |= FLAG_MTIME;
+	    config_flags |= TMPWATCH_MTIME;
 	    break;
 	case 'c':
-	    config_flags |= FLAG_CTIME;
+	    config_flags |= TMPWATCH_CTIME;
 	    break;
 	case 'U': {
-	    struct excluded_uid *u;
-	    struct passwd *pwd;
-
-	    if ( (u = malloc(sizeof (*u))) == NULL )
-	        message(LOG_FATAL, "error allocating memory\n.");
-	    pwd = getpwnam(optarg);
-	    if (pwd != NULL)
-	        u->uid = pwd->pw_uid;
-	    else {
-		intmax_t imax;
-		char *p;
+	    uid_t uid;
 
-		errno = 0;
-		imax = strtoimax(optarg, &p, 10);
-		if (errno != 0 || *p != 0 || p == optarg
-		    || (uid_t)imax != imax)
-		    message(LOG_FATAL, "unknown user %s\n", optarg);
-		u->uid = imax;
-	    }
-	    u->next = NULL;
-	    *excluded_uids_tail = u;
-	    excluded_uids_tail = &u->next;
+	    if (lookup_user(optarg, &uid) != 0)
+		message(LOG_FATAL, "unknown user %s\n", optarg);
+	    add_cli_exclusion(arg, optarg, uid);
 	    break;
 	}
 	case 'x': {
-	    struct exclusion *e;
-	    char *path, *p;
+	    char *path;
 
-	    if ( (e = malloc(sizeof (*e))) == NULL )
-	        message(LOG_FATAL, "error allocating memory\n.");
 	    path = absolute_path(optarg, 1);
 	    if (*path != '/') {
 		message(LOG_ERROR, "%s is not an absolute path\n", path);
 		usage();
 	    }
-	    p = strrchr(path, '/');
-	    assert (p != NULL);
-	    e->file = p + 1;
-	    if (p == path)
-		e->dir = "/";
-	    else {
-		*p = 0;
-		e->dir = path;
-	    }
-	    e->next = NULL;
-	    *exclusions_tail = e;
-	    exclusions_tail = &e->next;
+	    add_cli_exclusion(arg, path, 0);
 	    break;
 	}
-	case 'X': {
-	    struct excluded_pattern *p;
-
-	    if ( (p = malloc(sizeof (*p))) == NULL )
-	        message(LOG_FATAL, "error allocating memory\n.");
-	    p->pattern = optarg;
-	    p->next = NULL;
-	    *excluded_patterns_tail = p;
-	    excluded_patterns_tail = &p->next;
+	case 'X':
+	    add_cli_exclusion(arg, optarg, 0);
 	    break;
-	}
 	case 'S': {
 	    /* shred files */
 	    #ifdef SHRED
-	        config_flags |= FLAG_SHRED;
+	        config_flags |= TMPWATCH_SHRED;
 		shredpath = SHRED;
 	    #endif
 	    break;
 	}
+	case OPT_SCAN_TO:
+	    scan_file = optarg;
+	    break;
+	case OPT_APPLY:
+	    apply_file = optarg;
+	    break;
+	case OPT_CONFIG:
+	    config_file = optarg;
+	    break;
+	case OPT_DEADLINE:
+	    deadline = parse_grace(optarg);
+	    if (deadline <= 0)
+		message(LOG_FATAL, "bad deadline %s\n", optarg);
+	    break;
+	case OPT_CHECKPOINT:
+	    checkpoint_file = optarg;
+	    break;
+	case OPT_SHARD:
+	    if (parse_shard(optarg, &shard_index, &shard_count,
+			    &shard_depth) != 0)
+		message(LOG_FATAL, "bad shard %s\n", optarg);
+	    break;
+	case OPT_QUARANTINE:
+	    quarantine = 1;
+	    break;
+	case OPT_PURGE_QUARANTINE:
+	    purge_quarantine = 1;
+	    break;
+	case OPT_UNBOUND_SOCKETS:
+	    config_flags |= TMPWATCH_UNBOUND_SOCKETS;
+	    break;
+	case OPT_PROFILE:
+	    profile_file = optarg;
+	    break;
+	case OPT_MAX_OPEN_DIRS: {
+	    char *p;
+
+	    errno = 0;
+	    max_open_dirs = strtoul(optarg, &p, 10);
+	    if (errno != 0 || *p != 0 || p == optarg || max_open_dirs == 0)
+		message(LOG_FATAL, "bad number of directories %s\n", optarg);
+	    break;
+	}
+	case OPT_PIPELINE: {
+	    char *p;
+
+	    errno = 0;
+	    pipeline = strtoul(optarg, &p, 10);
+	    if (errno != 0 || *p != 0 || p == optarg || pipeline == 0)
+		message(LOG_FATAL, "bad queue length %s\n", optarg);
+	    break;
+	}
+	case OPT_SIMULATE:
+	    simulate_spec = optarg;
+	    break;
+	case OPT_STATUS_SOCKET:
+	    status_socket = optarg;
+	    break;
+	case OPT_TRUNCATE: {
+	    char *p;
+
+	    truncate_size = parse_size(optarg, &p);
+	    if (truncate_size > 0 && *p == ',') {
+		truncate_step = parse_size(p + 1, &p);
+		if (truncate_step > 0 && *p == ',') {
+		    char *q;
+
+		    q = p + 1;
+		    errno = 0;
+		    truncate_pause = strtoul(q, &p, 10);
+		    if (errno != 0 || p == q || truncate_pause > UINT_MAX)
+			truncate_step = -1;
+		}
+	    }
+	    if (truncate_size <= 0 || truncate_step <= 0 || *p != 0)
+		message(LOG_FATAL, "bad --truncate setting %s\n", optarg);
+	    break;
+	}
+	case OPT_ESTIMATE:
+	    estimate = DEFAULT_ESTIMATE_ENTRIES;
+	    if (optarg != NULL) {
+		char *p;
+
+		errno = 0;
+		estimate = strtoul(optarg, &p, 10);
+		if (errno != 0 || *p != 0 || p == optarg || estimate == 0)
+		    message(LOG_FATAL, "bad number of entries %s\n", optarg);
+	    }
+	    break;
 	case '?':
 	default:
 	    usage();
@@ -917,77 +1253,222 @@ fprintf(stdout,"%s\n",optstring);
     }
 
     /* Default to atime if neither was specified. - alh */
-    if ((config_flags & (FLAG_ATIME | FLAG_MTIME | FLAG_CTIME)) == 0)
-	config_flags |= FLAG_ATIME;
+    if ((config_flags
+	 & (TMPWATCH_ATIME | TMPWATCH_MTIME | TMPWATCH_CTIME)) == 0)
+	config_flags |= TMPWATCH_ATIME;
+    if (checkpoint_file != NULL)
+	config_flags |= TMPWATCH_CHECKPOINT;
+    if (profile_file != NULL) {
+	config_flags |= TMPWATCH_PROFILE;
+	if ((profile = profile_new()) == NULL)
+	    message(LOG_FATAL, "error allocating memory\n");
+    }
 
-    if (optind == argc) {
-	message(LOG_FATAL, "time (in hours) must be given\n");
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.log = log_message;
+    if (scan_file != NULL)
+	callbacks.decide = record_decision;
+    if (profile != NULL)
+	callbacks.profile = record_profile;
+    tw = tmpwatch_new(config_flags, shredpath, logLevel, &callbacks, NULL);
+    if (tw == NULL)
+	message(LOG_FATAL, "cannot initialize: %s\n", strerror(errno));
+    tmpwatch_set_max_open_dirs(tw, max_open_dirs);
+    tmpwatch_set_pipeline(tw, pipeline);
+    tmpwatch_set_shard(tw, shard_index, shard_count, shard_depth);
+    if (tmpwatch_set_truncate(tw, truncate_size, truncate_step,
+			      truncate_pause) != 0)
+	message(LOG_FATAL, "cannot free large files gradually: %s\n",
+		strerror(errno));
+    if ((quarantine || purge_quarantine)
+	&& tmpwatch_set_quarantine(tw, QUARANTINE_NAME) != 0)
+	message(LOG_FATAL, "cannot use a quarantine: %s\n", strerror(errno));
+    if (simulate_spec != NULL) {
+	const char *error;
+
+	if (estimate != 0 || apply_file != NULL)
+	    message(LOG_FATAL, "--simulate can not be combined with "
+		    "--estimate or --apply\n");
+	simfs = simfs_new(simulate_spec, time(NULL), &error);
+	if (simfs == NULL && error == NULL)
+	    message(LOG_FATAL, "error allocating memory\n");
+	if (simfs == NULL)
+	    message(LOG_FATAL, "bad --simulate setting %s: %s\n",
+		    simulate_spec, error);
+	if (tmpwatch_set_fs(tw, &simfs_ops, simfs) != 0)
+	    message(LOG_FATAL, "--simulate can not be combined with --fuser, "
+		    "--shred, --pipeline, --truncate, --quarantine or "
+		    "--purge-quarantine\n");
     }
 
-    switch (sscanf(argv[optind], "%d%c%c", &grace, &units, &garbage)) {
-    case 1:
-	grace *= 60;
-	break; /* hours by default */
-    case 2:
-	switch (units) {
-	case 'd':
-	    grace *= 24 * 60; /* days to minutes */
-	    break;
-	case 'h':
-	    grace *= 60; /* hours to minutes */
-	    break;
-	case 'm':
-	    break; /* minutes */
-	default:
-	    grace = -1;  /* invalid */
-	}
-	break;
-    default:
-	grace = -1; /* invalid */
+    if (shard_count != 1 && apply_file != NULL)
+	message(LOG_FATAL, "--shard can not be combined with --apply\n");
+    if (purge_quarantine
+	&& (scan_file != NULL || apply_file != NULL || estimate != 0
+	    || shard_count != 1))
+	message(LOG_FATAL, "--purge-quarantine can not be combined with "
+		"--scan-to, --apply, --estimate or --shard\n");
+    if (estimate != 0 && (scan_file != NULL || apply_file != NULL))
+	message(LOG_FATAL, "--estimate can not be combined with --scan-to or "
+		"--apply\n");
+    if (apply_file != NULL) {
+	if (scan_file != NULL)
+	    message(LOG_FATAL, "--scan-to and --apply can not be combined\n");
+	if (optind != argc)
+	    message(LOG_FATAL, "no time or directories expected with "
+		    "--apply\n");
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	apply_manifest(apply_file);
+	tmpwatch_free(tw);
+	return 0;
     }
 
-    if (grace < 0)
-	message(LOG_FATAL, "bad time argument %s\n", argv[optind]);
+    if (config_file != NULL) {
+	if (optind != argc)
+	    message(LOG_FATAL, "no time or directories expected with "
+		    "--config\n");
+	read_config(config_file);
+    } else {
+	int grace;
+
+	if (optind == argc) {
+	    message(LOG_FATAL, "time (in hours) must be given\n");
+	}
 
-    compute_kill_times(grace);
+	grace = parse_grace(argv[optind]);
+	if (grace < 0)
+	    message(LOG_FATAL, "bad time argument %s\n", argv[optind]);
 
-    optind++;
-    if (optind == argc) {
-	message(LOG_FATAL, "directory name(s) expected\n");
+	optind++;
+	if (optind == argc) {
+	    message(LOG_FATAL, "directory name(s) expected\n");
+	}
+	add_cli_roots(argv + optind, argc - optind, grace);
     }
 
     /* set stdout line buffered so it is flushed before each fork */
     setvbuf(stdout, NULL, _IOLBF, 0);
 
+    /* Lease breaks for --fuser and --truncate need no action */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGIO, &sa, NULL);
+
+    /* Stop at the next directory entry; SA_RESTART keeps the fuser and shred
+       children from being disturbed */
+    sa.sa_handler = stop_handler;
+    sa.sa_flags = SA_RESTART;
+    if (deadline != 0) {
+	sigaction(SIGALRM, &sa, NULL);
+	alarm(deadline * 60);
+    }
+    if (estimate != 0) {
+	estimate_roots(estimate);
+	tmpwatch_free(tw);
+	return 0;
+    }
+    if (purge_quarantine) {
+	purge_roots();
+	tmpwatch_free(tw);
+	return 0;
+    }
+    if (checkpoint_file != NULL) {
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	read_checkpoint();
+    }
+
+    if (scan_file != NULL) {
+	struct manifest_header header;
+
+	memset(&header, 0, sizeof(header));
+	header.flags = config_flags;
+	scan_manifest = manifest_create(scan_file, &header);
+	if (scan_manifest == NULL)
+	    message(LOG_FATAL, "cannot create manifest %s: %s\n", scan_file,
+		    strerror(errno));
+    }
+
+    /* Report progress on SIGUSR1 and to clients of the status socket */
+    if (monitor_start(tw, status_socket) != 0) {
+	if (status_socket != NULL)
+	    message(LOG_FATAL, "cannot listen at %s: %s\n", status_socket,
+		    strerror(errno));
+	if (errno != ENOSYS)
+	    message(LOG_VERBOSE, "cannot report progress: %s\n",
+		    strerror(errno));
+    }
+
     orig_dir = open(".", O_RDONLY);
     if (orig_dir == -1)
 	message(LOG_FATAL, "cannot open current directory\n");
-    while (optind < argc) {
-	char *path;
-
-	path = absolute_path(argv[optind], 0);
-	if (lstat(path, &sb) != 0) {
-	    message(LOG_ERROR, "lstat() of directory %s failed: %s\n", path,
-		    strerror(errno));
-	    exit(1);
+    {
+	size_t i, first;
+
+	/* Roots before the one in the checkpoint were finished */
+	first = 0;
+	if (resume_root != NULL) {
+	    while (first < num_policies
+		   && strcmp(tmpwatch_policy_root(policies[first]),
+			     resume_root) != 0)
+		first++;
+	    if (first == num_policies) {
+		discard_resume();
+		first = 0;
+	    }
 	}
-
-	if (S_ISLNK(sb.st_mode)) {
-	    message(LOG_DEBUG, "initial directory %s is a symlink -- "
-		    "skipping\n", path);
-	} else {
-	    /* add shred path to call */
-	    if (cleanupDirectory(path, path, sb.st_dev, sb.st_ino, shredpath) == 0)
-		message(LOG_ERROR, "cleanup failed in %s: %s\n", path,
-			strerror(errno));
-	    if (fchdir(orig_dir) != 0) {
-		message(LOG_FATAL, "can not return to original working "
-			"directory: %s\n", strerror(errno));
+	/* Rules from --config are sorted, so each rule comes after the rules
+	   for its parent directories; a nested rule is normally visited while
+	   cleaning up its parent's root, and only needs a walk of its own if
+	   that walk didn't reach it (e.g. it is on a different filesystem).
+	   Command-line roots are cleaned up in the order given; a walk skips
+	   the contents of roots that were cleaned up before it. */
+	for (i = first; i < num_policies; i++) {
+	    const char *root;
+
+	    if (tmpwatch_policy_visited(policies[i]))
+		continue;
+	    root = tmpwatch_policy_root(policies[i]);
+	    if (tmpwatch_sweep(tw, root, policies[i]) != 0
+		&& config_file == NULL) {
+		monitor_stop();
+		exit(1);
 	    }
+	    if (end_root(root, orig_dir))
+		break;
 	}
-	optind++;
     }
     close(orig_dir);
+    monitor_stop();
+
+    /* A complete sweep starts from the beginning next time */
+    if (checkpoint_file != NULL && !tmpwatch_interrupted(tw)
+	&& unlink(checkpoint_file) != 0 && errno != ENOENT)
+	message(LOG_ERROR, "cannot remove %s: %s\n", checkpoint_file,
+		strerror(errno));
+
+    if (scan_manifest != NULL && manifest_close(scan_manifest) != 0)
+	message(LOG_FATAL, "error writing manifest %s: %s\n", scan_file,
+		strerror(errno));
+    if (profile != NULL) {
+	if (profile_write(profile, profile_file) != 0)
+	    message(LOG_FATAL, "error writing profile %s: %s\n",
+		    profile_file, strerror(errno));
+	profile_free(profile);
+    }
+    if (simfs != NULL) {
+	struct simfs_stats stats;
+
+	simfs_stats(simfs, &stats);
+	message(LOG_NORMAL, "simulated %lu directories and %lu files, removed "
+		"%lu; %lu lstat, %lu readdir, %lu unlink and %lu rmdir "
+		"calls\n", stats.dirs, stats.files, stats.removed,
+		stats.ops[SIMFS_LSTAT], stats.ops[SIMFS_READDIR],
+		stats.ops[SIMFS_UNLINK], stats.ops[SIMFS_RMDIR]);
+	simfs_free(simfs);
+    }
+    tmpwatch_free(tw);
 
     return 0;
 }
@@ -0,0 +1,168 @@
+/* truncator.c -- gradual freeing of large removed files in a separate thread
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <config.h>
+
+#ifdef HAVE_PTHREAD_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "truncator.h"
+
+/* A queued file */
+struct job
+{
+    int fd;
+    off_t size;
+};
+
+struct truncator
+{
+    pthread_t thread;
+    off_t step;
+    struct timespec pause;
+    /* Protects everything below */
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+    struct job *jobs;		/* A ring of queue_len jobs */
+    size_t queue_len, head, count;
+    int stopping;		/* No more jobs will be queued */
+};
+
+/* Free the blocks of JOB from the end, a step at a time, and close it */
+static void
+run_job(const struct truncator *t, const struct job *job)
+{
+    off_t size;
+
+    size = job->size;
+    while (size > t->step) {
+	size -= t->step;
+	/* On error, close() frees whatever is left at once */
+	if (ftruncate(job->fd, size) != 0)
+	    break;
+	while (nanosleep(&t->pause, NULL) != 0 && errno == EINTR)
+	    ;
+    }
+    close(job->fd);
+}
+
+static void *
+truncator_thread(void *arg)
+{
+    struct truncator *t;
+
+    t = arg;
+    pthread_mutex_lock(&t->lock);
+    for (;;) {
+	struct job job;
+
+	while (t->count == 0 && !t->stopping)
+	    pthread_cond_wait(&t->not_empty, &t->lock);
+	if (t->count == 0)
+	    break;
+	job = t->jobs[t->head];
+	t->head = (t->head + 1) % t->queue_len;
+	t->count--;
+	pthread_cond_signal(&t->not_full);
+	pthread_mutex_unlock(&t->lock);
+
+	run_job(t, &job);
+
+	pthread_mutex_lock(&t->lock);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+struct truncator *
+truncator_start(size_t queue_len, off_t step, unsigned pause_ms)
+{
+    struct truncator *t;
+    sigset_t all, old;
+    int err;
+
+    if (queue_len == 0 || step <= 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    if ((t = calloc(1, sizeof(*t))) == NULL)
+	return NULL;
+    if ((t->jobs = calloc(queue_len, sizeof(*t->jobs))) == NULL) {
+	free(t);
+	return NULL;
+    }
+    t->queue_len = queue_len;
+    t->step = step;
+    t->pause.tv_sec = pause_ms / 1000;
+    t->pause.tv_nsec = (long)(pause_ms % 1000) * 1000000;
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->not_empty, NULL);
+    pthread_cond_init(&t->not_full, NULL);
+    /* Signals are handled by the thread that walks the tree */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&t->thread, NULL, truncator_thread, t);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+	pthread_cond_destroy(&t->not_full);
+	pthread_cond_destroy(&t->not_empty);
+	pthread_mutex_destroy(&t->lock);
+	free(t->jobs);
+	free(t);
+	errno = err;
+	return NULL;
+    }
+    return t;
+}
+
+void
+truncator_submit(struct truncator *t, int fd, off_t size)
+{
+    struct job *job;
+
+    pthread_mutex_lock(&t->lock);
+    /* Each queued file holds a descriptor */
+    while (t->count == t->queue_len)
+	pthread_cond_wait(&t->not_full, &t->lock);
+    job = &t->jobs[(t->head + t->count) % t->queue_len];
+    job->fd = fd;
+    job->size = size;
+    t->count++;
+    pthread_cond_signal(&t->not_empty);
+    pthread_mutex_unlock(&t->lock);
+}
+
+void
+truncator_finish(struct truncator *t)
+{
+    pthread_mutex_lock(&t->lock);
+    t->stopping = 1;
+    pthread_cond_signal(&t->not_empty);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->thread, NULL);
+
+    pthread_cond_destroy(&t->not_full);
+    pthread_cond_destroy(&t->not_empty);
+    pthread_mutex_destroy(&t->lock);
+    free(t->jobs);
+    free(t);
+}
+
+#endif /* HAVE_PTHREAD_H */
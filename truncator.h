@@ -0,0 +1,66 @@
+/* truncator.h -- gradual freeing of large removed files in a separate thread
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef TRUNCATOR_H__
+#define TRUNCATOR_H__
+
+#include <config.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* A thread shrinking queued files, which were already unlinked, a step at a
+   time before closing them, so that freeing their blocks does not stall the
+   filesystem */
+struct truncator;
+
+/* Use the same condition as in truncator.c! */
+#ifdef HAVE_PTHREAD_H
+
+/* Start a thread truncating the files queued by truncator_submit() by STEP
+   bytes at a time, sleeping PAUSE_MS milliseconds after each step, with at
+   most QUEUE_LEN files queued at a time.
+   Return NULL with errno set on error. */
+extern struct truncator *truncator_start(size_t queue_len, off_t step,
+					 unsigned pause_ms);
+
+/* Queue FD, an open unlinked regular file of SIZE bytes, to be truncated and
+   closed by T, waiting while the queue is full.  FD is owned by T after this
+   call. */
+extern void truncator_submit(struct truncator *t, int fd, off_t size);
+
+/* Wait until all files queued in T are closed, stop its thread and free
+   it. */
+extern void truncator_finish(struct truncator *t);
+
+#else /* !HAVE_PTHREAD_H */
+
+static struct truncator *truncator_start(size_t queue_len, off_t step,
+					 unsigned pause_ms)
+{
+    (void)queue_len;
+    (void)step;
+    (void)pause_ms;
+    errno = ENOSYS;
+    return NULL;
+}
+
+/* Never called without a truncator */
+#define truncator_submit(T, FD, SIZE) ((void)0)
+#define truncator_finish(T) ((void)0)
+
+#endif /* HAVE_PTHREAD_H */
+
+#endif
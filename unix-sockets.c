@@ -0,0 +1,230 @@
+/* unix-sockets.c -- the Unix domain sockets bound in the system
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <config.h>
+
+#ifdef HAVE_LINUX_UNIX_DIAG_H
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/unix_diag.h>
+
+#include "unix-sockets.h"
+
+/* /proc/net/unix lists the inodes of the sockets themselves, in sockfs;
+   only the sock_diag interface reports the inodes of the files they are
+   bound to, which is what a sweep sees.  The kernel reports only the low
+   32 bits of the inode number, so a collision makes an unbound socket look
+   bound, which is harmless. */
+
+/* Return the key of the socket file DEV, INO, with DEV encoded as in the
+   kernel (major << 20 | minor); never 0 */
+static uint64_t
+socket_key(uint32_t dev, uint32_t ino)
+{
+    return ((uint64_t)dev << 32 | ino) + 1;
+}
+
+/* Return the slot of KEY in US for a lookup or an insertion */
+static size_t
+find_slot(const struct unix_sockets *us, uint64_t key)
+{
+    uint64_t h;
+    size_t i;
+
+    /* A 64-bit finalizer of MurmurHash3 */
+    h = key;
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    for (i = h & us->mask; us->slots[i] != 0 && us->slots[i] != key;
+	 i = (i + 1) & us->mask)
+	;
+    return i;
+}
+
+/* Add KEY to US, whose table is kept at most half full.
+   Return 0 if OK, -1 on error. */
+static int
+add_socket(struct unix_sockets *us, size_t *count, uint64_t key)
+{
+    size_t i;
+
+    if (2 * (*count + 1) > us->mask + 1) {
+	uint64_t *old;
+	size_t old_size, j;
+
+	old = us->slots;
+	old_size = us->mask + 1;
+	if ((us->slots = calloc(2 * old_size, sizeof(*us->slots))) == NULL) {
+	    us->slots = old;
+	    return -1;
+	}
+	us->mask = 2 * old_size - 1;
+	for (j = 0; j < old_size; j++) {
+	    if (old[j] != 0)
+		us->slots[find_slot(us, old[j])] = old[j];
+	}
+	free(old);
+    }
+    i = find_slot(us, key);
+    if (us->slots[i] == 0) {
+	us->slots[i] = key;
+	(*count)++;
+    }
+    return 0;
+}
+
+/* Add the socket file of the sock_diag reply MSG of LEN bytes, if any, to
+   US.  Return 0 if OK, -1 on error. */
+static int
+add_reply(struct unix_sockets *us, size_t *count, struct unix_diag_msg *msg,
+	  size_t len)
+{
+    struct rtattr *attr;
+    int attr_len;
+
+    if (len < NLMSG_ALIGN(sizeof(*msg)))
+	return 0;
+    attr = (struct rtattr *)((char *)msg + NLMSG_ALIGN(sizeof(*msg)));
+    attr_len = len - NLMSG_ALIGN(sizeof(*msg));
+    for (; RTA_OK(attr, attr_len); attr = RTA_NEXT(attr, attr_len)) {
+	if (attr->rta_type == UNIX_DIAG_VFS
+	    && RTA_PAYLOAD(attr) >= sizeof(struct unix_diag_vfs)) {
+	    struct unix_diag_vfs vfs;
+
+	    memcpy(&vfs, RTA_DATA(attr), sizeof(vfs));
+	    return add_socket(us, count, socket_key(vfs.udiag_vfs_dev,
+						    vfs.udiag_vfs_ino));
+	}
+    }
+    return 0;
+}
+
+int
+unix_sockets_read(struct unix_sockets *us)
+{
+    static long buffer[8192 / sizeof(long)];
+
+    struct
+    {
+	struct nlmsghdr nlh;
+	struct unix_diag_req req;
+    } request;
+    size_t count;
+    int fd, err, done;
+
+    us->state = -1;
+    us->mask = 63;
+    if ((us->slots = calloc(us->mask + 1, sizeof(*us->slots))) == NULL)
+	return -1;
+    count = 0;
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (fd == -1)
+	goto err;
+    memset(&request, 0, sizeof(request));
+    request.nlh.nlmsg_len = sizeof(request);
+    request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.req.sdiag_family = AF_UNIX;
+    request.req.udiag_states = ~0U;
+    request.req.udiag_show = UDIAG_SHOW_VFS;
+    if (send(fd, &request, sizeof(request), 0) != sizeof(request))
+	goto err_fd;
+    done = 0;
+    while (!done) {
+	struct nlmsghdr *h;
+	ssize_t len;
+
+	len = recv(fd, buffer, sizeof(buffer), 0);
+	if (len == -1) {
+	    if (errno == EINTR)
+		continue;
+	    goto err_fd;
+	}
+	if (len == 0) {
+	    errno = EIO;
+	    goto err_fd;
+	}
+	for (h = (struct nlmsghdr *)buffer; NLMSG_OK(h, len);
+	     h = NLMSG_NEXT(h, len)) {
+	    if (h->nlmsg_type == NLMSG_DONE) {
+		done = 1;
+		break;
+	    }
+	    if (h->nlmsg_type == NLMSG_ERROR) {
+		const struct nlmsgerr *e;
+
+		/* E.g. ENOENT without the unix_diag module */
+		e = NLMSG_DATA(h);
+		if (h->nlmsg_len >= NLMSG_LENGTH(sizeof(*e)) && e->error < 0)
+		    errno = -e->error;
+		else
+		    errno = EIO;
+		goto err_fd;
+	    }
+	    if (h->nlmsg_type == SOCK_DIAG_BY_FAMILY
+		&& add_reply(us, &count, NLMSG_DATA(h),
+			     h->nlmsg_len - NLMSG_LENGTH(0)) != 0)
+		goto err_fd;
+	}
+    }
+    close(fd);
+    us->state = 1;
+    return 0;
+
+ err_fd:
+    err = errno;
+    close(fd);
+    errno = err;
+ err:
+    free(us->slots);
+    us->slots = NULL;
+    return -1;
+}
+
+int
+unix_socket_bound(const struct unix_sockets *us, dev_t dev, ino_t ino)
+{
+    unsigned maj, min;
+    uint64_t key;
+
+    maj = major(dev);
+    min = minor(dev);
+    /* Device numbers the kernel can't report are assumed to match */
+    if (maj >= 1U << 12 || min >= 1U << 20)
+	return 1;
+    key = socket_key(maj << 20 | min, (uint32_t)ino);
+    return us->slots[find_slot(us, key)] != 0;
+}
+
+void
+unix_sockets_free(struct unix_sockets *us)
+{
+    free(us->slots);
+    us->slots = NULL;
+    us->state = 0;
+}
+
+#endif /* HAVE_LINUX_UNIX_DIAG_H */
@@ -0,0 +1,63 @@
+/* unix-sockets.h -- the Unix domain sockets bound in the system
+ *
+ * Copyright (C) 2026 Peter Hyman
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions of the
+ * GNU General Public License v.2.  This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY expressed or implied,
+ * including the implied warranties of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef UNIX_SOCKETS_H__
+#define UNIX_SOCKETS_H__
+
+#include <config.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* The socket files that a socket is bound to, as a hash set */
+struct unix_sockets
+{
+    int state;			/* 0 = not read, 1 = valid, -1 = unknown */
+    uint64_t *slots;		/* 0 = empty */
+    size_t mask;		/* Of slots, a power of two minus 1 */
+};
+
+/* Use the same condition as in unix-sockets.c! */
+#ifdef HAVE_LINUX_UNIX_DIAG_H
+
+/* Read the socket files that a socket of the network namespace of the
+   process is bound to into US, and set us->state.
+   Return 0 if OK, -1 with errno set. */
+extern int unix_sockets_read(struct unix_sockets *us);
+
+/* Return 1 if a socket may be bound to the socket file DEV, INO in US,
+   0 if none is.  US must be valid. */
+extern int unix_socket_bound(const struct unix_sockets *us, dev_t dev,
+			     ino_t ino);
+
+extern void unix_sockets_free(struct unix_sockets *us);
+
+#else /* !HAVE_LINUX_UNIX_DIAG_H */
+
+static int unix_sockets_read(struct unix_sockets *us)
+{
+    us->state = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+/* Never called with a valid table */
+#define unix_socket_bound(US, DEV, INO) 1
+#define unix_sockets_free(US) ((void)0)
+
+#endif /* HAVE_LINUX_UNIX_DIAG_H */
+
+#endif